@@ -88,7 +88,10 @@ typedef enum attribute_flags {
     ATTRIBUTE_FLAG_NULLABLE = ATTRIBUTE_MASK_NULLABLE, /* 0x40 */
     /** The attribute read and write are overridden. The attribute value will be fetched from and will be updated using
     the override callback. The value of this attribute is not maintained internally. */
-    ATTRIBUTE_FLAG_OVERRIDE = ATTRIBUTE_FLAG_NULLABLE << 1, /* 0x100 */
+    ATTRIBUTE_FLAG_OVERRIDE = ATTRIBUTE_FLAG_NULLABLE << 1, /* 0x80 */
+    /** The attribute is written even if the new value is the same as the current one. By default, these writes are
+    skipped. */
+    ATTRIBUTE_FLAG_WRITE_ALWAYS = ATTRIBUTE_FLAG_OVERRIDE << 1, /* 0x100 */
 } attribute_flags_t;
 
 /** Command flags */
@@ -17,8 +17,11 @@
 #include <esp_matter_attribute_utils.h>
 #include <esp_matter_console.h>
 #include <esp_matter_core.h>
+#include <esp_timer.h>
 #include <string.h>
 
+#include <atomic>
+
 #include <app/util/attribute-storage.h>
 #include <protocols/interaction_model/Constants.h>
 
@@ -441,6 +444,8 @@ esp_matter_attr_val_t esp_matter_array(uint8_t *val, uint16_t data_size, uint16_
 }
 
 namespace esp_matter {
+extern bool is_started();
+
 namespace attribute {
 
 static esp_matter_val_type_t get_val_type_from_attribute_type(int attribute_type);
@@ -840,6 +845,19 @@ static esp_err_t console_get_handler(int argc, char **argv)
     return ESP_OK;
 }
 
+static esp_err_t console_trace_handler(int argc, char **argv)
+{
+    if (argc == 0) {
+        trace_print();
+        return ESP_OK;
+    }
+    if (argc == 2 && strncmp(argv[0], "level", sizeof("level")) == 0) {
+        return set_trace_level((trace_level_t)atoi(argv[1]));
+    }
+    ESP_LOGE(TAG, "The arguments for this command is invalid");
+    return ESP_ERR_INVALID_ARG;
+}
+
 static esp_err_t console_dispatch(int argc, char **argv)
 {
     if (argc <= 0) {
@@ -876,6 +894,14 @@ static void register_console_commands()
                            "Example: matter esp attribute get 0x0001 0x0006 0x0000.",
             .handler = console_get_handler,
         },
+        {
+            .name = "trace",
+            .description = "Print the attribute reads and changes from the trace, or set the trace level "
+                           "(0: none, 1: changes, 2: changes and reads). "
+                           "Usage: matter esp attribute trace [level <level>]. "
+                           "Example: matter esp attribute trace level 1.",
+            .handler = console_trace_handler,
+        },
     };
     attribute_console.register_commands(attribute_commands, sizeof(attribute_commands)/sizeof(esp_matter::console::command_t));
     esp_matter::console::add_commands(&command, 1);
@@ -894,9 +920,123 @@ esp_err_t set_callback(callback_t callback)
     return ESP_OK;
 }
 
+/* Path callbacks
+ *
+ * Callbacks registered for an attribute path or a cluster, sorted by endpoint, cluster and attribute ID, so that
+ * they are found with a binary search. The cluster callbacks have kInvalidAttributeId as the attribute ID.
+ */
+typedef struct path_callback {
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    callback_t callback;
+    void *priv_data;
+} path_callback_t;
+
+static path_callback_t *path_callbacks = NULL;
+static uint16_t path_callback_count = 0;
+
+static int compare_path(const path_callback_t *entry, uint16_t endpoint_id, uint32_t cluster_id,
+                        uint32_t attribute_id)
+{
+    if (entry->endpoint_id != endpoint_id) {
+        return entry->endpoint_id < endpoint_id ? -1 : 1;
+    }
+    if (entry->cluster_id != cluster_id) {
+        return entry->cluster_id < cluster_id ? -1 : 1;
+    }
+    if (entry->attribute_id != attribute_id) {
+        return entry->attribute_id < attribute_id ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Returns the index of the path callback, or the index where it should be inserted if it is not found */
+static int find_path_callback(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, bool *found)
+{
+    int low = 0;
+    int high = (int)path_callback_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int result = compare_path(&path_callbacks[mid], endpoint_id, cluster_id, attribute_id);
+        if (result == 0) {
+            *found = true;
+            return mid;
+        }
+        if (result < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+esp_err_t set_callback(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, callback_t callback,
+                       void *priv_data)
+{
+    /* Take lock if not already taken, the callbacks are executed in the Matter thread. Before start, the Matter thread
+    is not running and the lock cannot be taken yet. */
+    lock::status_t lock_status = lock::ALREADY_TAKEN;
+    if (is_started()) {
+        lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_CALLBACK);
+        if (lock_status == lock::FAILED) {
+            ESP_LOGE(TAG, "Could not get task context");
+            return ESP_FAIL;
+        }
+    }
+    esp_err_t err = ESP_OK;
+    bool found = false;
+    int index = find_path_callback(endpoint_id, cluster_id, attribute_id, &found);
+    if (found) {
+        if (callback) {
+            path_callbacks[index].callback = callback;
+            path_callbacks[index].priv_data = priv_data;
+        } else {
+            /* Remove */
+            memmove(&path_callbacks[index], &path_callbacks[index + 1],
+                    (path_callback_count - index - 1) * sizeof(path_callback_t));
+            path_callback_count--;
+        }
+    } else if (callback) {
+        path_callback_t *new_path_callbacks = (path_callback_t *)realloc(path_callbacks, (path_callback_count + 1) *
+                                                                          sizeof(path_callback_t));
+        if (!new_path_callbacks) {
+            ESP_LOGE(TAG, "Couldn't allocate the path callbacks");
+            err = ESP_ERR_NO_MEM;
+        } else {
+            path_callbacks = new_path_callbacks;
+            memmove(&path_callbacks[index + 1], &path_callbacks[index],
+                    (path_callback_count - index) * sizeof(path_callback_t));
+            path_callbacks[index].endpoint_id = endpoint_id;
+            path_callbacks[index].cluster_id = cluster_id;
+            path_callbacks[index].attribute_id = attribute_id;
+            path_callbacks[index].callback = callback;
+            path_callbacks[index].priv_data = priv_data;
+            path_callback_count++;
+        }
+    }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
+
 static esp_err_t execute_callback(callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
                                   uint32_t attribute_id, esp_matter_attr_val_t *val)
 {
+    if (path_callback_count > 0) {
+        bool found = false;
+        int index = find_path_callback(endpoint_id, cluster_id, attribute_id, &found);
+        if (!found) {
+            index = find_path_callback(endpoint_id, cluster_id, chip::kInvalidAttributeId, &found);
+        }
+        if (found) {
+            path_callback_t *entry = &path_callbacks[index];
+            return entry->callback(type, endpoint_id, cluster_id, attribute_id, val, entry->priv_data);
+        }
+    }
     if (attribute_callback) {
         void *priv_data = endpoint::get_priv_data(endpoint_id);
         return attribute_callback(type, endpoint_id, cluster_id, attribute_id, val, priv_data);
@@ -917,788 +1057,873 @@ static esp_err_t execute_override_callback(attribute_t *attribute, callback_type
     return ESP_OK;
 }
 
-static esp_matter_val_type_t get_val_type_from_attribute_type(int attribute_type)
+/* Codec for one esp_matter_val_type_t, shared by the conversions to and from the Ember attribute data */
+typedef struct val_type_info {
+    /** ZCL type of the attribute */
+    EmberAfAttributeType attribute_type;
+    /** Size of the attribute data. 0 for the types with a length prefix, whose size is in the val itself. */
+    uint8_t size;
+    /** The type has a nullable variant */
+    bool nullable;
+    /** Checks if the val holds the null value */
+    bool (*is_null)(const esp_matter_attr_val_t *val);
+    /** Writes the val to the attribute data */
+    void (*encode)(const esp_matter_attr_val_t *val, uint8_t *value);
+    /** Reads the val from the attribute data */
+    void (*decode)(esp_matter_attr_val_t *val, uint16_t attribute_size, const uint8_t *value);
+    /** Gets the val as an integer, for printing */
+    int64_t (*get_integer)(const esp_matter_attr_val_t *val);
+} val_type_info_t;
+
+/* All the members of the val union start at the same address, so the numeric types are accessed as T directly. */
+template <typename T>
+static bool is_null_numeric(const esp_matter_attr_val_t *val)
 {
-    switch (attribute_type) {
-    case ZCL_BOOLEAN_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_BOOLEAN;
-        break;
-
-    case ZCL_SINGLE_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_FLOAT;
-        break;
-
-    case ZCL_ARRAY_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_ARRAY;
-        break;
-
-    case ZCL_CHAR_STRING_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_CHAR_STRING;
-        break;
-
-    case ZCL_OCTET_STRING_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_OCTET_STRING;
-        break;
-
-    case ZCL_INT8S_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_INT8;
-        break;
-
-    case ZCL_INT8U_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_UINT8;
-        break;
+    using Traits = chip::app::NumericAttributeTraits<T>;
+    return Traits::IsNullValue(*(const T *)&val->val);
+}
 
-    case ZCL_INT16S_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_INT16;
-        break;
+template <typename T>
+static void encode_numeric(const esp_matter_attr_val_t *val, uint8_t *value)
+{
+    using Traits = chip::app::NumericAttributeTraits<T>;
+    typename Traits::StorageType attribute_value;
+    if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(*(const T *)&val->val)) {
+        Traits::SetNull(attribute_value);
+    } else {
+        Traits::WorkingToStorage(*(const T *)&val->val, attribute_value);
+    }
+    memcpy(value, &attribute_value, sizeof(attribute_value));
+}
 
-    case ZCL_INT16U_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_UINT16;
-        break;
+template <typename T>
+static void decode_numeric(esp_matter_attr_val_t *val, uint16_t attribute_size, const uint8_t *value)
+{
+    using Traits = chip::app::NumericAttributeTraits<T>;
+    typename Traits::StorageType attribute_value;
+    memcpy(&attribute_value, value, sizeof(attribute_value));
+    *(T *)&val->val = Traits::StorageToWorking(attribute_value);
+}
 
-    case ZCL_INT32S_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_INT32;
-        break;
+template <typename T>
+static int64_t get_integer_numeric(const esp_matter_attr_val_t *val)
+{
+    return (int64_t)*(const T *)&val->val;
+}
 
-    case ZCL_INT32U_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_UINT32;
-        break;
+template <typename T>
+static constexpr val_type_info_t numeric_type_info(EmberAfAttributeType attribute_type, bool nullable)
+{
+    return {attribute_type, sizeof(typename chip::app::NumericAttributeTraits<T>::StorageType), nullable,
+            is_null_numeric<T>, encode_numeric<T>, decode_numeric<T>, get_integer_numeric<T>};
+}
 
-    case ZCL_INT64S_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_INT64;
-        break;
+static void encode_string(const esp_matter_attr_val_t *val, uint8_t *value)
+{
+    int data_size_len = val->val.a.t - val->val.a.s;
+    memcpy(value, (uint8_t *)&val->val.a.s, data_size_len);
+    memcpy((value + data_size_len), (uint8_t *)val->val.a.b, (val->val.a.t - data_size_len));
+}
 
-    case ZCL_INT64U_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_UINT64;
-        break;
+static void decode_array(esp_matter_attr_val_t *val, uint16_t attribute_size, const uint8_t *value)
+{
+    *val = esp_matter_array(NULL, 0, 0);
+    int data_size_len = val->val.a.t - val->val.a.s;
+    int data_count = 0;
+    memcpy(&data_count, &value[0], data_size_len);
+    *val = esp_matter_array((uint8_t *)(value + data_size_len), attribute_size, data_count);
+}
 
-    case ZCL_ENUM8_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_ENUM8;
-        break;
+static void decode_char_str(esp_matter_attr_val_t *val, uint16_t attribute_size, const uint8_t *value)
+{
+    *val = esp_matter_char_str(NULL, 0);
+    int data_size_len = val->val.a.t - val->val.a.s;
+    int data_count = 0;
+    memcpy(&data_count, &value[0], data_size_len);
+    *val = esp_matter_char_str((char *)(value + data_size_len), data_count);
+}
 
-    case ZCL_BITMAP8_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_BITMAP8;
-        break;
+static void decode_octet_str(esp_matter_attr_val_t *val, uint16_t attribute_size, const uint8_t *value)
+{
+    *val = esp_matter_octet_str(NULL, 0);
+    int data_size_len = val->val.a.t - val->val.a.s;
+    int data_count = 0;
+    memcpy(&data_count, &value[0], data_size_len);
+    *val = esp_matter_octet_str((uint8_t *)(value + data_size_len), data_count);
+}
 
-    case ZCL_BITMAP16_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_BITMAP16;
-        break;
+static constexpr val_type_info_t string_type_info(EmberAfAttributeType attribute_type,
+                                                  void (*decode)(esp_matter_attr_val_t *, uint16_t, const uint8_t *))
+{
+    return {attribute_type, 0, false, NULL, encode_string, decode, NULL};
+}
 
-    case ZCL_BITMAP32_ATTRIBUTE_TYPE:
-        return ESP_MATTER_VAL_TYPE_BITMAP32;
-        break;
+/* Indexed by the esp_matter_val_type_t without the nullable bit */
+static constexpr val_type_info_t val_type_info_list[] = {
+    /* ESP_MATTER_VAL_TYPE_INVALID */ {ZCL_NO_DATA_ATTRIBUTE_TYPE, 0, false, NULL, NULL, NULL, NULL},
+    /* ESP_MATTER_VAL_TYPE_BOOLEAN */ numeric_type_info<bool>(ZCL_BOOLEAN_ATTRIBUTE_TYPE, false),
+    /* ESP_MATTER_VAL_TYPE_INTEGER */ numeric_type_info<int>(ZCL_INT16U_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_FLOAT */ numeric_type_info<float>(ZCL_SINGLE_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_ARRAY */ string_type_info(ZCL_ARRAY_ATTRIBUTE_TYPE, decode_array),
+    /* ESP_MATTER_VAL_TYPE_CHAR_STRING */ string_type_info(ZCL_CHAR_STRING_ATTRIBUTE_TYPE, decode_char_str),
+    /* ESP_MATTER_VAL_TYPE_OCTET_STRING */ string_type_info(ZCL_OCTET_STRING_ATTRIBUTE_TYPE, decode_octet_str),
+    /* ESP_MATTER_VAL_TYPE_INT8 */ numeric_type_info<int8_t>(ZCL_INT8S_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_UINT8 */ numeric_type_info<uint8_t>(ZCL_INT8U_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_INT16 */ numeric_type_info<int16_t>(ZCL_INT16S_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_UINT16 */ numeric_type_info<uint16_t>(ZCL_INT16U_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_INT32 */ numeric_type_info<int32_t>(ZCL_INT32S_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_UINT32 */ numeric_type_info<uint32_t>(ZCL_INT32U_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_INT64 */ numeric_type_info<int64_t>(ZCL_INT64S_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_UINT64 */ numeric_type_info<uint64_t>(ZCL_INT64U_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_ENUM8 */ numeric_type_info<uint8_t>(ZCL_ENUM8_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_BITMAP8 */ numeric_type_info<uint8_t>(ZCL_BITMAP8_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_BITMAP16 */ numeric_type_info<uint16_t>(ZCL_BITMAP16_ATTRIBUTE_TYPE, true),
+    /* ESP_MATTER_VAL_TYPE_BITMAP32 */ numeric_type_info<uint32_t>(ZCL_BITMAP32_ATTRIBUTE_TYPE, true),
+};
+static_assert(sizeof(val_type_info_list) / sizeof(val_type_info_list[0]) == ESP_MATTER_VAL_TYPE_BITMAP32 + 1,
+              "val_type_info_list must have an entry for every esp_matter_val_type_t");
+
+static const val_type_info_t *get_val_type_info(esp_matter_val_type_t type)
+{
+    uint8_t index = type & ~ESP_MATTER_VAL_NULLANLE_BASE;
+    if (index == ESP_MATTER_VAL_TYPE_INVALID || index > ESP_MATTER_VAL_TYPE_BITMAP32) {
+        return NULL;
+    }
+    if ((type & ESP_MATTER_VAL_NULLANLE_BASE) && !val_type_info_list[index].nullable) {
+        return NULL;
+    }
+    return &val_type_info_list[index];
+}
 
-    default:
-        return ESP_MATTER_VAL_TYPE_INVALID;
-        break;
+static esp_matter_val_type_t get_val_type_from_attribute_type(int attribute_type)
+{
+    /* Search from the end, so that ZCL_INT16U_ATTRIBUTE_TYPE resolves to UINT16 and not to INTEGER */
+    for (int index = ESP_MATTER_VAL_TYPE_BITMAP32; index > ESP_MATTER_VAL_TYPE_INVALID; index--) {
+        if (val_type_info_list[index].attribute_type == attribute_type) {
+            return (esp_matter_val_type_t)index;
+        }
     }
     return ESP_MATTER_VAL_TYPE_INVALID;
 }
 
 bool val_is_null(esp_matter_attr_val_t *val)
 {
-    switch (val->type) {
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INTEGER:
-        return chip::app::NumericAttributeTraits<int>::IsNullValue(val->val.i);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_ENUM8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP8:
-        return chip::app::NumericAttributeTraits<uint8_t>::IsNullValue(val->val.u8);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT16:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP16:
-        return chip::app::NumericAttributeTraits<uint16_t>::IsNullValue(val->val.u16);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT32:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP32:
-        return chip::app::NumericAttributeTraits<uint32_t>::IsNullValue(val->val.u32);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT64:
-        return chip::app::NumericAttributeTraits<uint64_t>::IsNullValue(val->val.u64);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT8:
-        return chip::app::NumericAttributeTraits<int8_t>::IsNullValue(val->val.i8);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT16:
-        return chip::app::NumericAttributeTraits<int16_t>::IsNullValue(val->val.i16);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT32:
-        return chip::app::NumericAttributeTraits<int32_t>::IsNullValue(val->val.i32);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT64:
-        return chip::app::NumericAttributeTraits<int64_t>::IsNullValue(val->val.i64);
-        break;
-    case ESP_MATTER_VAL_TYPE_NULLABLE_FLOAT:
-        return chip::app::NumericAttributeTraits<float>::IsNullValue(val->val.f);
-        break;
-    default:
+    if (!(val->type & ESP_MATTER_VAL_NULLANLE_BASE)) {
         return false;
-        break;
     }
-    return false;
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (!info) {
+        return false;
+    }
+    return info->is_null(val);
 }
 
 esp_err_t get_data_from_attr_val(esp_matter_attr_val_t *val, EmberAfAttributeType *attribute_type,
                                  uint16_t *attribute_size, uint8_t *value)
 {
-    switch (val->type) {
-    case ESP_MATTER_VAL_TYPE_BOOLEAN:
-        if (attribute_type) {
-            *attribute_type = ZCL_BOOLEAN_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(bool);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<bool>;
-            Traits::WorkingToStorage(val->val.b, *value);
-        }
-        break;
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (!info) {
+        ESP_LOGE(TAG, "esp_matter_attr_val_type_t not handled: %d", val->type);
+        return ESP_OK;
+    }
+    if (attribute_type) {
+        *attribute_type = info->attribute_type;
+    }
+    if (attribute_size) {
+        *attribute_size = info->size ? info->size : val->val.a.t;
+    }
+    if (value) {
+        info->encode(val, value);
+    }
+    return ESP_OK;
+}
 
-    case ESP_MATTER_VAL_TYPE_INTEGER:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INTEGER:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT16U_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(int);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<int>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.i)) {
-                Traits::SetNull(*(int *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i, *(int *)value);
-            }
-        }
-        break;
+static esp_err_t get_attr_val_from_data(esp_matter_attr_val_t *val, EmberAfAttributeType attribute_type,
+                                        uint16_t attribute_size, uint8_t *value,
+                                        const EmberAfAttributeMetadata * attribute_metadata)
+{
+    esp_matter_val_type_t type = get_val_type_from_attribute_type(attribute_type);
+    const val_type_info_t *info = get_val_type_info(type);
+    if (!info) {
+        *val = esp_matter_invalid(NULL);
+        return ESP_OK;
+    }
 
-    case ESP_MATTER_VAL_TYPE_FLOAT:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_FLOAT:
-        if (attribute_type) {
-            *attribute_type = ZCL_SINGLE_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(float);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<float>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.f)) {
-                Traits::SetNull(*(float *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.f, *(float *)value);
-            }
-        }
-        break;
+    memset(val, 0, sizeof(esp_matter_attr_val_t));
+    val->type = type;
+    info->decode(val, attribute_size, value);
+    if (info->nullable && attribute_metadata->IsNullable()) {
+        val->type = (esp_matter_val_type_t)(type | ESP_MATTER_VAL_NULLANLE_BASE);
+    }
+    return ESP_OK;
+}
 
-    case ESP_MATTER_VAL_TYPE_ARRAY:
-        if (attribute_type) {
-            *attribute_type = ZCL_ARRAY_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = val->val.a.t;
-        }
-        if (value) {
-            int data_size_len = val->val.a.t - val->val.a.s;
-            memcpy(value, (uint8_t *)&val->val.a.s, data_size_len);
-            memcpy((value + data_size_len), (uint8_t *)val->val.a.b, (*attribute_size - data_size_len));
-        }
-        break;
+void val_print(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    if (val_is_null(val)) {
+        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is null **********", endpoint_id,
+                 cluster_id, attribute_id);
+        return;
+    }
 
-    case ESP_MATTER_VAL_TYPE_CHAR_STRING:
-        if (attribute_type) {
-            *attribute_type = ZCL_CHAR_STRING_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = val->val.a.t;
-        }
-        if (value) {
-            int data_size_len = val->val.a.t - val->val.a.s;
-            memcpy(value, (uint8_t *)&val->val.a.s, data_size_len);
-            memcpy((value + data_size_len), (uint8_t *)val->val.a.b, (*attribute_size - data_size_len));
-        }
-        break;
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (val->type == ESP_MATTER_VAL_TYPE_FLOAT || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_FLOAT) {
+        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %f **********", endpoint_id,
+                 cluster_id, attribute_id, val->val.f);
+    } else if (val->type == ESP_MATTER_VAL_TYPE_CHAR_STRING) {
+        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %.*s **********", endpoint_id,
+                 cluster_id, attribute_id, val->val.a.s, val->val.a.b);
+    } else if (info && info->get_integer) {
+        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %lld **********", endpoint_id,
+                 cluster_id, attribute_id, info->get_integer(val));
+    } else {
+        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is <invalid type: %d> **********",
+                 endpoint_id, cluster_id, attribute_id, val->type);
+    }
+}
 
-    case ESP_MATTER_VAL_TYPE_OCTET_STRING:
-        if (attribute_type) {
-            *attribute_type = ZCL_OCTET_STRING_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = val->val.a.t;
-        }
-        if (value) {
-            int data_size_len = val->val.a.t - val->val.a.s;
-            memcpy(value, (uint8_t *)&val->val.a.s, data_size_len);
-            memcpy((value + data_size_len), (uint8_t *)val->val.a.b, (*attribute_size - data_size_len));
-        }
-        break;
+/* Attribute trace
+ *
+ * Ring of binary records of the attribute reads and changes from Matter, which are only decoded on demand. Writers
+ * reserve a position with an atomic increment, then publish the record by storing position + 1 in its sequence. The
+ * reader copies the record and checks that the sequence is unchanged, so it skips the records which are being
+ * written or were overwritten in the meantime.
+ */
+typedef enum trace_event {
+    TRACE_EVENT_READ,
+    TRACE_EVENT_CHANGE,
+} trace_event_t;
+
+#if CONFIG_ESP_MATTER_ATTRIBUTE_TRACE_ENABLE
+#define TRACE_SIZE CONFIG_ESP_MATTER_ATTRIBUTE_TRACE_SIZE
+#define TRACE_MASK (TRACE_SIZE - 1)
+static_assert((TRACE_SIZE & TRACE_MASK) == 0, "The attribute trace size must be a power of 2");
+
+typedef struct trace_record {
+    std::atomic<uint32_t> sequence;
+    uint32_t time_ms;
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    uint16_t endpoint_id;
+    uint8_t event;
+    uint8_t type;
+    /* Size of the string values, for which only the size is recorded */
+    uint16_t size;
+    /* Numeric value, as in esp_matter_val_t */
+    uint64_t value;
+} trace_record_t;
+
+static trace_record_t trace_ring[TRACE_SIZE];
+static std::atomic<uint32_t> trace_write_pos(0);
+static trace_level_t trace_level = TRACE_LEVEL_READ;
+
+static void trace(trace_event_t event, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                  esp_matter_attr_val_t *val)
+{
+    trace_level_t level = event == TRACE_EVENT_READ ? TRACE_LEVEL_READ : TRACE_LEVEL_CHANGE;
+    if (trace_level < level) {
+        return;
+    }
+    uint32_t pos = trace_write_pos.fetch_add(1, std::memory_order_relaxed);
+    trace_record_t *record = &trace_ring[pos & TRACE_MASK];
+    record->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    record->cluster_id = cluster_id;
+    record->attribute_id = attribute_id;
+    record->endpoint_id = endpoint_id;
+    record->event = event;
+    record->type = val->type;
+    record->size = 0;
+    record->value = 0;
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (info && !info->size) {
+        record->size = val->val.a.s;
+    } else {
+        memcpy(&record->value, &val->val, sizeof(record->value));
+    }
+    record->sequence.store(pos + 1, std::memory_order_release);
+}
 
-    case ESP_MATTER_VAL_TYPE_INT8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT8:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT8S_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(int8_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<int8_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.i8)) {
-                Traits::SetNull(*(int8_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i8, *(int8_t *)value);
-            }
-        }
-        break;
+esp_err_t set_trace_level(trace_level_t level)
+{
+    trace_level = level;
+    return ESP_OK;
+}
 
-    case ESP_MATTER_VAL_TYPE_UINT8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT8:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT8U_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint8_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u8)) {
-                Traits::SetNull(*(uint8_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u8, *(uint8_t *)value);
-            }
+void trace_print()
+{
+    uint32_t write_pos = trace_write_pos.load(std::memory_order_acquire);
+    uint32_t pos = write_pos > TRACE_SIZE ? write_pos - TRACE_SIZE : 0;
+    for (; pos != write_pos; pos++) {
+        trace_record_t *entry = &trace_ring[pos & TRACE_MASK];
+        trace_record_t record;
+        if (entry->sequence.load(std::memory_order_acquire) != pos + 1) {
+            continue;
+        }
+        record.time_ms = entry->time_ms;
+        record.cluster_id = entry->cluster_id;
+        record.attribute_id = entry->attribute_id;
+        record.endpoint_id = entry->endpoint_id;
+        record.event = entry->event;
+        record.type = entry->type;
+        record.size = entry->size;
+        record.value = entry->value;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry->sequence.load(std::memory_order_relaxed) != pos + 1) {
+            continue;
+        }
+
+        const char *event = record.event == TRACE_EVENT_READ ? "read" : "change";
+        esp_matter_attr_val_t val = esp_matter_invalid(NULL);
+        val.type = (esp_matter_val_type_t)record.type;
+        memcpy(&val.val, &record.value, sizeof(record.value));
+        const val_type_info_t *info = get_val_type_info(val.type);
+        if (val_is_null(&val)) {
+            ESP_LOGI(TAG, "%u ms: %s endpoint 0x%04X cluster 0x%04X attribute 0x%04X: null", record.time_ms,
+                     event, record.endpoint_id, record.cluster_id, record.attribute_id);
+        } else if (info && !info->size) {
+            ESP_LOGI(TAG, "%u ms: %s endpoint 0x%04X cluster 0x%04X attribute 0x%04X: <%d bytes>", record.time_ms,
+                     event, record.endpoint_id, record.cluster_id, record.attribute_id, record.size);
+        } else if (val.type == ESP_MATTER_VAL_TYPE_FLOAT || val.type == ESP_MATTER_VAL_TYPE_NULLABLE_FLOAT) {
+            ESP_LOGI(TAG, "%u ms: %s endpoint 0x%04X cluster 0x%04X attribute 0x%04X: %f", record.time_ms, event,
+                     record.endpoint_id, record.cluster_id, record.attribute_id, val.val.f);
+        } else if (info) {
+            ESP_LOGI(TAG, "%u ms: %s endpoint 0x%04X cluster 0x%04X attribute 0x%04X: %lld", record.time_ms, event,
+                     record.endpoint_id, record.cluster_id, record.attribute_id, info->get_integer(&val));
+        } else {
+            ESP_LOGI(TAG, "%u ms: %s endpoint 0x%04X cluster 0x%04X attribute 0x%04X: <invalid type: %d>",
+                     record.time_ms, event, record.endpoint_id, record.cluster_id, record.attribute_id, val.type);
         }
-        break;
+    }
+}
+#else
+static inline void trace(trace_event_t event, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                         esp_matter_attr_val_t *val)
+{
+}
 
-    case ESP_MATTER_VAL_TYPE_INT16:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT16:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT16S_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(int16_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<int16_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.i16)) {
-                Traits::SetNull(*(int16_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i16, *(int16_t *)value);
-            }
-        }
-        break;
+esp_err_t set_trace_level(trace_level_t level)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
 
-    case ESP_MATTER_VAL_TYPE_UINT16:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT16:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT16U_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint16_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint16_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u16)) {
-                Traits::SetNull(*(uint16_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u16, *(uint16_t *)value);
-            }
-        }
-        break;
+void trace_print()
+{
+    ESP_LOGE(TAG, "Attribute trace is disabled, enable CONFIG_ESP_MATTER_ATTRIBUTE_TRACE_ENABLE");
+}
+#endif // CONFIG_ESP_MATTER_ATTRIBUTE_TRACE_ENABLE
 
-    case ESP_MATTER_VAL_TYPE_INT32:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT32:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT32S_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(int32_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<int32_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.i32)) {
-                Traits::SetNull(*(int32_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i32, *(int32_t *)value);
-            }
-        }
-        break;
+esp_err_t get_val_as_double(esp_matter_attr_val_t *val, double *value)
+{
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (!info || !info->get_integer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_matter_val_type_t type = (esp_matter_val_type_t)(val->type & ~ESP_MATTER_VAL_NULLANLE_BASE);
+    if (type == ESP_MATTER_VAL_TYPE_FLOAT) {
+        *value = val->val.f;
+    } else if (type == ESP_MATTER_VAL_TYPE_UINT64) {
+        *value = (double)val->val.u64;
+    } else {
+        *value = (double)info->get_integer(val);
+    }
+    return ESP_OK;
+}
 
-    case ESP_MATTER_VAL_TYPE_UINT32:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT32:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT32U_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint32_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint32_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u32)) {
-                Traits::SetNull(*(uint32_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u32, *(uint32_t *)value);
-            }
-        }
-        break;
+esp_err_t get_val_raw(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, uint8_t *value,
+                      uint16_t attribute_size)
+{
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_GET_VAL_RAW);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
 
-    case ESP_MATTER_VAL_TYPE_INT64:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_INT64:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT64S_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(int64_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<int64_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.i64)) {
-                Traits::SetNull(*(int64_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i64, *(int64_t *)value);
-            }
+    EmberAfStatus status = emberAfReadServerAttribute(endpoint_id, cluster_id, attribute_id, value, attribute_size);
+    if (status != EMBER_ZCL_STATUS_SUCCESS) {
+        ESP_LOGE(TAG, "Error getting raw value from matter: 0x%x", status);
+        if (lock_status == lock::SUCCESS) {
+            lock::chip_stack_unlock();
         }
-        break;
+        return ESP_FAIL;
+    }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return ESP_OK;
+}
 
-    case ESP_MATTER_VAL_TYPE_UINT64:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_UINT64:
-        if (attribute_type) {
-            *attribute_type = ZCL_INT64U_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint64_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint64_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u64)) {
-                Traits::SetNull(*(uint64_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i8, *(uint64_t *)value);
-            }
-        }
-        break;
+static bool is_string_val(esp_matter_attr_val_t *val)
+{
+    return val->type == ESP_MATTER_VAL_TYPE_CHAR_STRING || val->type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
+           val->type == ESP_MATTER_VAL_TYPE_ARRAY;
+}
 
-    case ESP_MATTER_VAL_TYPE_ENUM8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_ENUM8:
-        if (attribute_type) {
-            *attribute_type = ZCL_ENUM8_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint8_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u8)) {
-                Traits::SetNull(*(uint8_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u8, *(uint8_t *)value);
-            }
-        }
-        break;
+/* Size of the stack buffer used for encoding the value in update(). This holds all the numeric values and the short
+strings. */
+#define UPDATE_STACK_VALUE_SIZE 64
+static_assert(UPDATE_STACK_VALUE_SIZE >= sizeof(uint64_t), "The numeric values must fit in the stack buffer");
 
-    case ESP_MATTER_VAL_TYPE_BITMAP8:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP8:
-        if (attribute_type) {
-            *attribute_type = ZCL_BITMAP8_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint8_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u8)) {
-                Traits::SetNull(*(uint8_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u8, *(uint8_t *)value);
-            }
-        }
-        break;
+/* This must be called with the chip stack lock held */
+extern bool check_update(attribute_t *attribute, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                         esp_matter_attr_val_t *val);
 
-    case ESP_MATTER_VAL_TYPE_BITMAP16:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP16:
-        if (attribute_type) {
-            *attribute_type = ZCL_BITMAP16_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint16_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint16_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u16)) {
-                Traits::SetNull(*(uint16_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.u16, *(uint16_t *)value);
-            }
-        }
-        break;
+static esp_err_t write_locked(attribute_t *attribute, uint16_t endpoint_id, uint32_t cluster_id,
+                              uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    /* Unchanged and filtered updates are not errors */
+    if (!check_update(attribute, endpoint_id, cluster_id, attribute_id, val)) {
+        return ESP_OK;
+    }
 
-    case ESP_MATTER_VAL_TYPE_BITMAP32:
-    case ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP32:
-        if (attribute_type) {
-            *attribute_type = ZCL_BITMAP32_ATTRIBUTE_TYPE;
-        }
-        if (attribute_size) {
-            *attribute_size = sizeof(uint32_t);
-        }
-        if (value) {
-            using Traits = chip::app::NumericAttributeTraits<uint32_t>;
-            if ((val->type & ESP_MATTER_VAL_NULLANLE_BASE) && Traits::IsNullValue(val->val.u32)) {
-                Traits::SetNull(*(uint32_t *)value);
-            } else {
-                Traits::WorkingToStorage(val->val.i8, *(uint32_t *)value);
-            }
+    /* Get value in a single pass. Only the long strings and arrays, whose size is known without encoding, need a heap
+    buffer. */
+    EmberAfAttributeType attribute_type = 0;
+    uint16_t attribute_size = 0;
+    uint8_t stack_value[UPDATE_STACK_VALUE_SIZE];
+    uint8_t *value = stack_value;
+    if (is_string_val(val) && val->val.a.t > sizeof(stack_value)) {
+        value = (uint8_t *)malloc(val->val.a.t);
+        if (!value) {
+            ESP_LOGE(TAG, "Could not allocate value buffer");
+            return ESP_ERR_NO_MEM;
         }
-        break;
-
-    default:
-        ESP_LOGE(TAG, "esp_matter_attr_val_type_t not handled: %d", val->type);
-        break;
     }
+    get_data_from_attr_val(val, &attribute_type, &attribute_size, value);
 
+    /* Update matter */
+    EmberAfStatus status = emberAfWriteServerAttribute(endpoint_id, cluster_id, attribute_id, value, attribute_type);
+    if (value != stack_value) {
+        free(value);
+    }
+    if (status != EMBER_ZCL_STATUS_SUCCESS) {
+        ESP_LOGE(TAG, "Error updating attribute to matter: 0x%X", status);
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
-static esp_err_t get_attr_val_from_data(esp_matter_attr_val_t *val, EmberAfAttributeType attribute_type,
-                                        uint16_t attribute_size, uint8_t *value,
-                                        const EmberAfAttributeMetadata * attribute_metadata)
+/* This is also used by the update policy timer of esp_matter_core.cpp */
+esp_err_t update_locked(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
 {
-    switch (attribute_type) {
-    case ZCL_BOOLEAN_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<bool>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        *val = esp_matter_bool(attribute_value);
-        break;
+    if (!emberAfContainsServer(endpoint_id, cluster_id)) {
+        return ESP_OK;
     }
+    return write_locked(NULL, endpoint_id, cluster_id, attribute_id, val);
+}
 
-    case ZCL_ARRAY_ATTRIBUTE_TYPE: {
-        *val = esp_matter_array(NULL, 0, 0);
-        int data_size_len = val->val.a.t - val->val.a.s;
-        int data_count = 0;
-        memcpy(&data_count, &value[0], data_size_len);
-        *val = esp_matter_array((value + data_size_len), attribute_size, data_count);
-        break;
+esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_UPDATE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
     }
+    esp_err_t err = update_locked(endpoint_id, cluster_id, attribute_id, val);
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
 
-    case ZCL_CHAR_STRING_ATTRIBUTE_TYPE: {
-        *val = esp_matter_char_str(NULL, 0);
-        int data_size_len = val->val.a.t - val->val.a.s;
-        int data_count = 0;
-        memcpy(&data_count, &value[0], data_size_len);
-        *val = esp_matter_char_str((char *)(value + data_size_len), data_count);
-        break;
+esp_err_t update_batch(update_item_t *items, size_t count)
+{
+    if (!items && count > 0) {
+        ESP_LOGE(TAG, "Items cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_UPDATE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < count; i++) {
+        esp_err_t item_err = update_locked(items[i].endpoint_id, items[i].cluster_id, items[i].attribute_id,
+                                           &items[i].val);
+        if (item_err != ESP_OK && err == ESP_OK) {
+            err = item_err;
+        }
+    }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
 
-    case ZCL_OCTET_STRING_ATTRIBUTE_TYPE: {
-        *val = esp_matter_octet_str(NULL, 0);
-        int data_size_len = val->val.a.t - val->val.a.s;
-        int data_count = 0;
-        memcpy(&data_count, &value[0], data_size_len);
-        *val = esp_matter_octet_str((value + data_size_len), data_count);
-        break;
+/* The numeric value of the attribute must have the size of the storage type of the caller, otherwise the other bytes
+of the value union would be read or left stale */
+static esp_err_t check_val_size(attribute_t *attribute, esp_matter_attr_val_t *val, size_t size)
+{
+    const val_type_info_t *info = get_val_type_info(val->type);
+    if (!info || info->size != size) {
+        ESP_LOGE(TAG, "Attribute 0x%04X has value type %d, which does not have %u bytes",
+                 get_id(attribute), val->type, (unsigned)size);
+        return ESP_ERR_INVALID_SIZE;
     }
+    return ESP_OK;
+}
 
-    case ZCL_INT8S_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<int8_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_int8(nullable<int8_t>());
-            } else {
-                *val = esp_matter_nullable_int8(attribute_value);
-            }
-        } else {
-            *val = esp_matter_int8(attribute_value);
+esp_err_t get_val(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, void *value,
+                  size_t size)
+{
+    if (!cache || !value) {
+        ESP_LOGE(TAG, "Cache or value cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Take lock if not already taken. The attribute is resolved and read with it, so that it is not destroyed
+    meanwhile. */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_GET);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    attribute_t *attribute = get(cache, endpoint_id, cluster_id, attribute_id);
+    if (attribute) {
+        esp_matter_attr_val_t val;
+        err = get_val(attribute, &val);
+        if (err == ESP_OK) {
+            err = check_val_size(attribute, &val, size);
+        }
+        if (err == ESP_OK) {
+            memcpy(value, &val.val, size);
         }
-        break;
     }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
 
-    case ZCL_INT8U_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_uint8(nullable<uint8_t>());
-            } else {
-                *val = esp_matter_nullable_uint8(attribute_value);
-            }
-        } else {
-            *val = esp_matter_uint8(attribute_value);
+esp_err_t update(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const void *value,
+                 size_t size)
+{
+    if (!cache || !value) {
+        ESP_LOGE(TAG, "Cache or value cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_UPDATE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    attribute_t *attribute = get(cache, endpoint_id, cluster_id, attribute_id);
+    if (attribute) {
+        esp_matter_attr_val_t val;
+        err = get_val(attribute, &val);
+        if (err == ESP_OK) {
+            err = check_val_size(attribute, &val, size);
+        }
+        /* Same as update(), nothing to do in matter if the endpoint is not enabled */
+        if (err == ESP_OK && cache->enabled) {
+            memcpy(&val.val, value, size);
+            err = write_locked(attribute, endpoint_id, cluster_id, attribute_id, &val);
         }
-        break;
     }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
 
-    case ZCL_INT16S_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<int16_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_int16(nullable<int16_t>());
-            } else {
-                *val = esp_matter_nullable_int16(attribute_value);
-            }
-        } else {
-            *val = esp_matter_int16(attribute_value);
-        }
-        break;
+typedef struct _resolved_attribute {
+    uint16_t endpoint_id;
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    cache_t cache;
+    /* Ember metadata of the attribute, resolved in the cache generation metadata_generation */
+    const EmberAfAttributeMetadata *metadata;
+    uint32_t metadata_generation;
+} _resolved_attribute_t;
+
+/* Handle being updated, so that the callbacks from Ember do not look the attribute up again. This is only accessed
+with the chip stack lock held. */
+static _resolved_attribute_t *current_resolved_attribute = NULL;
+
+static bool is_current_resolved_attribute(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    _resolved_attribute_t *resolved = current_resolved_attribute;
+    return resolved && resolved->attribute_id == attribute_id && resolved->cluster_id == cluster_id &&
+           resolved->endpoint_id == endpoint_id;
+}
+
+static attribute_t *get_attribute(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    if (is_current_resolved_attribute(endpoint_id, cluster_id, attribute_id)) {
+        return current_resolved_attribute->cache.attribute;
     }
+    return get(endpoint_id, cluster_id, attribute_id);
+}
 
-    case ZCL_INT16U_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint16_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_uint16(nullable<uint16_t>());
-            } else {
-                *val = esp_matter_nullable_uint16(attribute_value);
-            }
-        } else {
-            *val = esp_matter_uint16(attribute_value);
-        }
-        break;
+static const EmberAfAttributeMetadata *get_attribute_metadata(uint16_t endpoint_id, uint32_t cluster_id,
+                                                              uint32_t attribute_id)
+{
+    if (is_current_resolved_attribute(endpoint_id, cluster_id, attribute_id)) {
+        return current_resolved_attribute->metadata;
     }
+    return emberAfLocateAttributeMetadata(endpoint_id, cluster_id, attribute_id);
+}
 
-    case ZCL_INT32S_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<int32_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_int32(nullable<int32_t>());
-            } else {
-                *val = esp_matter_nullable_int32(attribute_value);
-            }
-        } else {
-            *val = esp_matter_int32(attribute_value);
-        }
-        break;
+resolved_attribute_t *resolve(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    _resolved_attribute_t *resolved = (_resolved_attribute_t *)calloc(1, sizeof(_resolved_attribute_t));
+    if (!resolved) {
+        ESP_LOGE(TAG, "Couldn't allocate _resolved_attribute_t");
+        return NULL;
     }
+    resolved->endpoint_id = endpoint_id;
+    resolved->cluster_id = cluster_id;
+    resolved->attribute_id = attribute_id;
+    /* Take lock if not already taken, the attribute index is protected by it */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_GET);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        free(resolved);
+        return NULL;
+    }
+    attribute_t *attribute = get(&resolved->cache, endpoint_id, cluster_id, attribute_id);
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    if (!attribute) {
+        ESP_LOGE(TAG, "Endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X not found", endpoint_id, cluster_id,
+                 attribute_id);
+        free(resolved);
+        return NULL;
+    }
+    return (resolved_attribute_t *)resolved;
+}
 
-    case ZCL_INT32U_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint32_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_uint32(nullable<uint32_t>());
-            } else {
-                *val = esp_matter_nullable_uint32(attribute_value);
-            }
-        } else {
-            *val = esp_matter_uint32(attribute_value);
-        }
-        break;
+esp_err_t update(resolved_attribute_t *handle, esp_matter_attr_val_t *val)
+{
+    if (!handle || !val) {
+        ESP_LOGE(TAG, "Handle or val cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
+    _resolved_attribute_t *resolved = (_resolved_attribute_t *)handle;
 
-    case ZCL_INT64S_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<int64_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_int64(nullable<int64_t>());
-            } else {
-                *val = esp_matter_nullable_int64(attribute_value);
-            }
-        } else {
-            *val = esp_matter_int64(attribute_value);
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ATTRIBUTE_UPDATE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_OK;
+    if (!get(&resolved->cache, resolved->endpoint_id, resolved->cluster_id, resolved->attribute_id)) {
+        ESP_LOGE(TAG, "Endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X does not exist anymore",
+                 resolved->endpoint_id, resolved->cluster_id, resolved->attribute_id);
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        /* The metadata only exists while the endpoint is enabled. The cache generation changes when it is disabled. */
+        if (!resolved->metadata || resolved->metadata_generation != resolved->cache.generation) {
+            resolved->metadata = emberAfLocateAttributeMetadata(resolved->endpoint_id, resolved->cluster_id,
+                                                                resolved->attribute_id);
+            resolved->metadata_generation = resolved->cache.generation;
+        }
+        /* Same as update(), nothing to do in matter if the endpoint is not enabled */
+        if (resolved->metadata) {
+            current_resolved_attribute = resolved;
+            err = write_locked(resolved->cache.attribute, resolved->endpoint_id, resolved->cluster_id,
+                               resolved->attribute_id, val);
+            current_resolved_attribute = NULL;
         }
-        break;
     }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
 
-    case ZCL_INT64U_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint64_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_uint64(nullable<uint64_t>());
-            } else {
-                *val = esp_matter_nullable_uint64(attribute_value);
-            }
-        } else {
-            *val = esp_matter_uint64(attribute_value);
-        }
-        break;
+esp_err_t release(resolved_attribute_t *handle)
+{
+    if (!handle) {
+        ESP_LOGE(TAG, "Handle cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
+    free(handle);
+    return ESP_OK;
+}
 
-    case ZCL_ENUM8_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_enum8(nullable<uint8_t>());
-            } else {
-                *val = esp_matter_nullable_enum8(attribute_value);
-            }
-        } else {
-            *val = esp_matter_enum8(attribute_value);
-        }
-        break;
+/* Update queue
+ *
+ * Bounded multi-producer multi-consumer ring (D. Vyukov's algorithm). Every entry has a sequence number: an entry at
+ * position pos can be written when its sequence is pos, and read when its sequence is pos + 1. Reading it sets the
+ * sequence to pos + UPDATE_QUEUE_SIZE for the next round. The sequence is stored relative to the index of the entry,
+ * so that the zero initialized queue is valid.
+ */
+#define UPDATE_QUEUE_SIZE CONFIG_ESP_MATTER_ATTRIBUTE_UPDATE_QUEUE_SIZE
+#define UPDATE_QUEUE_MASK (UPDATE_QUEUE_SIZE - 1)
+static_assert((UPDATE_QUEUE_SIZE & UPDATE_QUEUE_MASK) == 0, "The update queue size must be a power of 2");
+
+typedef struct update_queue_entry {
+    std::atomic<uint32_t> sequence;
+    update_item_t item;
+} update_queue_entry_t;
+
+static update_queue_entry_t update_queue[UPDATE_QUEUE_SIZE];
+static std::atomic<uint32_t> update_queue_write_pos(0);
+static std::atomic<uint32_t> update_queue_read_pos(0);
+static std::atomic<bool> update_queue_drain_scheduled(false);
+/* This is only used by the Matter thread */
+static update_item_t update_queue_batch[UPDATE_QUEUE_SIZE];
+
+static void free_update_queue_item(update_item_t *item)
+{
+    if (is_string_val(&item->val)) {
+        free(item->val.val.a.b);
     }
+}
 
-    case ZCL_BITMAP8_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint8_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_bitmap8(nullable<uint8_t>());
-            } else {
-                *val = esp_matter_nullable_bitmap8(attribute_value);
+static bool update_queue_push(update_item_t *item)
+{
+    update_queue_entry_t *entry = NULL;
+    uint32_t pos = update_queue_write_pos.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t index = pos & UPDATE_QUEUE_MASK;
+        entry = &update_queue[index];
+        uint32_t sequence = entry->sequence.load(std::memory_order_acquire) + index;
+        int32_t diff = (int32_t)(sequence - pos);
+        if (diff == 0) {
+            if (update_queue_write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
             }
+        } else if (diff < 0) {
+            /* Full */
+            return false;
         } else {
-            *val = esp_matter_bitmap8(attribute_value);
+            pos = update_queue_write_pos.load(std::memory_order_relaxed);
         }
-        break;
     }
+    entry->item = *item;
+    entry->sequence.store(pos + 1 - (pos & UPDATE_QUEUE_MASK), std::memory_order_release);
+    return true;
+}
 
-    case ZCL_BITMAP16_ATTRIBUTE_TYPE: {
-        using Traits = chip::app::NumericAttributeTraits<uint16_t>;
-        Traits::StorageType attribute_value;
-        memcpy((uint8_t *)&attribute_value, value, sizeof(Traits::StorageType));
-        if (attribute_metadata->IsNullable()) {
-            if (Traits::IsNullValue(attribute_value)) {
-                *val = esp_matter_nullable_bitmap16(nullable<uint16_t>());
-            } else {
-                *val = esp_matter_nullable_bitmap16(attribute_value);
+static bool update_queue_pop(update_item_t *item)
+{
+    update_queue_entry_t *entry = NULL;
+    uint32_t pos = update_queue_read_pos.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t index = pos & UPDATE_QUEUE_MASK;
+        entry = &update_queue[index];
+        uint32_t sequence = entry->sequence.load(std::memory_order_acquire) + index;
+        int32_t diff = (int32_t)(sequence - (pos + 1));
+        if (diff == 0) {
+            if (update_queue_read_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
             }
+        } else if (diff < 0) {
+            /* Empty */
+            return false;
         } else {
-            *val = esp_matter_bitmap16(attribute_value);
+            pos = update_queue_read_pos.load(std::memory_order_relaxed);
         }
-        break;
-    }
-
-    default:
-        *val = esp_matter_invalid(NULL);
-        break;
     }
-
-    return ESP_OK;
+    *item = entry->item;
+    entry->sequence.store(pos + UPDATE_QUEUE_SIZE - (pos & UPDATE_QUEUE_MASK), std::memory_order_release);
+    return true;
 }
 
-void val_print(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+static void update_queue_drain(intptr_t context);
+
+static void schedule_update_queue_drain()
 {
-    if (val_is_null(val)) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is null **********", endpoint_id,
-                 cluster_id, attribute_id);
+    if (update_queue_drain_scheduled.exchange(true)) {
         return;
     }
-
-    if (val->type == ESP_MATTER_VAL_TYPE_BOOLEAN) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.b);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_INTEGER || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_INTEGER) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.i);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_FLOAT || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_FLOAT) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %f **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.f);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_UINT8 || val->type == ESP_MATTER_VAL_TYPE_BITMAP8
-               || val->type == ESP_MATTER_VAL_TYPE_ENUM8 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT8
-               || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP8 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_ENUM8) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.u8);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_INT16 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_INT16) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.i16);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_UINT16 || val->type == ESP_MATTER_VAL_TYPE_BITMAP16
-               || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT16 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP16) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.u16);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_INT32|| val->type == ESP_MATTER_VAL_TYPE_NULLABLE_INT32) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.i32);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_UINT32 || val->type == ESP_MATTER_VAL_TYPE_BITMAP32
-               || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT32 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_BITMAP32) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %d **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.u32);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_INT64 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_INT64) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %lld **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.i64);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_UINT64 || val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT64) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %lld **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.u64);
-    } else if (val->type == ESP_MATTER_VAL_TYPE_CHAR_STRING) {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is %.*s **********", endpoint_id,
-                 cluster_id, attribute_id, val->val.a.s, val->val.a.b);
-    } else {
-        ESP_LOGI(TAG, "********** Endpoint 0x%04X's Cluster 0x%04X's Attribute 0x%04X is <invalid type: %d> **********",
-                 endpoint_id, cluster_id, attribute_id, val->type);
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(update_queue_drain, 0) != CHIP_NO_ERROR) {
+        /* The event queue is full. The queued updates stay in the ring and the drain is scheduled again by the next
+        update_async(). */
+        update_queue_drain_scheduled.store(false);
+        ESP_LOGW(TAG, "Could not schedule the update queue drain");
     }
 }
 
-esp_err_t get_val_raw(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, uint8_t *value,
-                      uint16_t attribute_size)
+static void update_queue_drain(intptr_t context)
 {
-    /* Take lock if not already taken */
-    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY);
-    if (lock_status == lock::FAILED) {
-        ESP_LOGE(TAG, "Could not get task context");
-        return ESP_FAIL;
+    /* Cleared first, so that an update queued while draining schedules the drain again */
+    update_queue_drain_scheduled.store(false);
+
+    /* Coalesce: the last queued value of an attribute replaces the earlier ones */
+    int count = 0;
+    update_item_t item;
+    while (count < UPDATE_QUEUE_SIZE && update_queue_pop(&item)) {
+        int i = 0;
+        for (; i < count; i++) {
+            update_item_t *queued = &update_queue_batch[i];
+            if (queued->endpoint_id == item.endpoint_id && queued->cluster_id == item.cluster_id &&
+                queued->attribute_id == item.attribute_id) {
+                free_update_queue_item(queued);
+                queued->val = item.val;
+                break;
+            }
+        }
+        if (i == count) {
+            update_queue_batch[count++] = item;
+        }
     }
 
-    EmberAfStatus status = emberAfReadServerAttribute(endpoint_id, cluster_id, attribute_id, value, attribute_size);
-    if (status != EMBER_ZCL_STATUS_SUCCESS) {
-        ESP_LOGE(TAG, "Error getting raw value from matter: 0x%x", status);
-        if (lock_status == lock::SUCCESS) {
-            lock::chip_stack_unlock();
+    /* This runs on the Matter thread, so the lock is already held */
+    for (int i = 0; i < count; i++) {
+        update_item_t *queued = &update_queue_batch[i];
+        esp_err_t err = update_locked(queued->endpoint_id, queued->cluster_id, queued->attribute_id, &queued->val);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Queued update of endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X failed: %d",
+                     queued->endpoint_id, queued->cluster_id, queued->attribute_id, err);
         }
-        return ESP_FAIL;
+        free_update_queue_item(queued);
     }
-    if (lock_status == lock::SUCCESS) {
-        lock::chip_stack_unlock();
+
+    /* The batch is full: drain the rest in the next work item, so that other events are not starved */
+    if (count == UPDATE_QUEUE_SIZE) {
+        schedule_update_queue_drain();
     }
-    return ESP_OK;
 }
 
-esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+esp_err_t update_async(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
 {
-    /* Take lock if not already taken */
-    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY);
-    if (lock_status == lock::FAILED) {
-        ESP_LOGE(TAG, "Could not get task context");
-        return ESP_FAIL;
+    if (!val) {
+        ESP_LOGE(TAG, "Val cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
-
-    /* Get size */
-    EmberAfAttributeType attribute_type = 0;
-    uint16_t attribute_size = 0;
-    get_data_from_attr_val(val, &attribute_type, &attribute_size, NULL);
-
-    /* Get value */
-    uint8_t *value = (uint8_t *)calloc(1, attribute_size);
-    if (!value) {
-        ESP_LOGE(TAG, "Could not allocate value buffer");
-        if (lock_status == lock::SUCCESS) {
-            lock::chip_stack_unlock();
-        }
-        return ESP_ERR_NO_MEM;
+    /* The queue is drained through the event queue of the Matter thread, which is only set up by start() */
+    if (!is_started()) {
+        ESP_LOGE(TAG, "Asynchronous updates need esp_matter to be started");
+        return ESP_ERR_INVALID_STATE;
     }
-    get_data_from_attr_val(val, &attribute_type, &attribute_size, value);
-
-    /* Update matter */
-    EmberAfStatus status = EMBER_ZCL_STATUS_SUCCESS;
-    if (emberAfContainsServer(endpoint_id, cluster_id)) {
-        status = emberAfWriteServerAttribute(endpoint_id, cluster_id, attribute_id, value, attribute_type);
-        if (status != EMBER_ZCL_STATUS_SUCCESS) {
-            ESP_LOGE(TAG, "Error updating attribute to matter: 0x%X", status);
-            free(value);
-            if (lock_status == lock::SUCCESS) {
-                lock::chip_stack_unlock();
+    update_item_t item = {
+        .endpoint_id = endpoint_id,
+        .cluster_id = cluster_id,
+        .attribute_id = attribute_id,
+        .val = *val,
+    };
+    if (is_string_val(val)) {
+        item.val.val.a.b = NULL;
+        if (val->val.a.s > 0) {
+            item.val.val.a.b = (uint8_t *)malloc(val->val.a.s);
+            if (!item.val.val.a.b) {
+                ESP_LOGE(TAG, "Could not allocate value buffer");
+                return ESP_ERR_NO_MEM;
             }
-            return ESP_FAIL;
+            memcpy(item.val.val.a.b, val->val.a.b, val->val.a.s);
         }
     }
-    free(value);
-    if (lock_status == lock::SUCCESS) {
-        lock::chip_stack_unlock();
+    if (!update_queue_push(&item)) {
+        ESP_LOGW(TAG, "Update queue full, dropping update of endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X",
+                 endpoint_id, cluster_id, attribute_id);
+        free_update_queue_item(&item);
+        /* In case the drain could not be scheduled when the queued updates were added */
+        schedule_update_queue_drain();
+        return ESP_ERR_NO_MEM;
     }
+    schedule_update_queue_drain();
     return ESP_OK;
 }
 
@@ -1711,13 +1936,13 @@ Status MatterPreAttributeChangeCallback(const chip::app::ConcreteAttributePath &
     uint16_t endpoint_id = path.mEndpointId;
     uint32_t cluster_id = path.mClusterId;
     uint32_t attribute_id = path.mAttributeId;
-    const EmberAfAttributeMetadata *attribute_metadata = emberAfLocateAttributeMetadata(endpoint_id, cluster_id,
-                                                                                      attribute_id);
+    const EmberAfAttributeMetadata *attribute_metadata = attribute::get_attribute_metadata(endpoint_id, cluster_id,
+                                                                                         attribute_id);
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
     attribute::get_attr_val_from_data(&val, type, size, value, attribute_metadata);
 
-    /* Print */
-    attribute::val_print(endpoint_id, cluster_id, attribute_id, &val);
+    /* Trace */
+    attribute::trace(attribute::TRACE_EVENT_CHANGE, endpoint_id, cluster_id, attribute_id, &val);
 
     /* Callback to application */
     esp_err_t err = execute_callback(attribute::PRE_UPDATE, endpoint_id, cluster_id, attribute_id, &val);
@@ -1733,8 +1958,8 @@ void MatterPostAttributeChangeCallback(const chip::app::ConcreteAttributePath &p
     uint16_t endpoint_id = path.mEndpointId;
     uint32_t cluster_id = path.mClusterId;
     uint32_t attribute_id = path.mAttributeId;
-    const EmberAfAttributeMetadata *attribute_metadata = emberAfLocateAttributeMetadata(endpoint_id, cluster_id,
-                                                                                      attribute_id);
+    const EmberAfAttributeMetadata *attribute_metadata = attribute::get_attribute_metadata(endpoint_id, cluster_id,
+                                                                                         attribute_id);
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
     attribute::get_attr_val_from_data(&val, type, size, value, attribute_metadata);
 
@@ -1748,13 +1973,10 @@ EmberAfStatus emberAfExternalAttributeReadCallback(EndpointId endpoint_id, Clust
 {
     /* Get value */
     uint32_t attribute_id = matter_attribute->attributeId;
-    node_t *node = node::get();
-    if (!node) {
+    attribute_t *attribute = attribute::get(endpoint_id, cluster_id, attribute_id);
+    if (!attribute) {
         return EMBER_ZCL_STATUS_FAILURE;
     }
-    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
-    cluster_t *cluster = cluster::get(endpoint, cluster_id);
-    attribute_t *attribute = attribute::get(cluster, attribute_id);
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
 
     int flags = attribute::get_flags(attribute);
@@ -1768,8 +1990,8 @@ EmberAfStatus emberAfExternalAttributeReadCallback(EndpointId endpoint_id, Clust
         attribute::get_val(attribute, &val);
     }
 
-    /* Print */
-    attribute::val_print(endpoint_id, cluster_id, attribute_id, &val);
+    /* Trace */
+    attribute::trace(attribute::TRACE_EVENT_READ, endpoint_id, cluster_id, attribute_id, &val);
 
     /* Get size */
     uint16_t attribute_size = 0;
@@ -1790,13 +2012,10 @@ EmberAfStatus emberAfExternalAttributeWriteCallback(EndpointId endpoint_id, Clus
 {
     /* Get value */
     uint32_t attribute_id = matter_attribute->attributeId;
-    node_t *node = node::get();
-    if (!node) {
+    attribute_t *attribute = attribute::get_attribute(endpoint_id, cluster_id, attribute_id);
+    if (!attribute) {
         return EMBER_ZCL_STATUS_FAILURE;
     }
-    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
-    cluster_t *cluster = cluster::get(endpoint, cluster_id);
-    attribute_t *attribute = attribute::get(cluster, attribute_id);
 
     /* Get val */
     /* This creates a new variable val, and stores the new attribute value in the new variable.
@@ -311,6 +311,26 @@ typedef esp_err_t (*callback_t)(callback_type_t type, uint16_t endpoint_id, uint
  */
 esp_err_t set_callback(callback_t callback);
 
+/** Set attribute path callback
+ *
+ * Set the callback for the updates of one attribute, or of all the attributes of a cluster. For the attributes with
+ * a path callback, the path callback is called instead of the common callback, so the other attribute updates do not
+ * reach it. The attribute callback takes precedence over the cluster callback. Setting a callback again for the same
+ * path replaces it. This can be called before or after `esp_matter::start()`.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID of the attribute. `chip::kInvalidAttributeId` for all the attributes of the
+ * cluster.
+ * @param[in] callback attribute update callback. NULL to remove the path callback.
+ * @param[in] priv_data Private data passed to the callback, instead of the private data of the endpoint.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t set_callback(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, callback_t callback,
+                       void *priv_data);
+
 /** Attribute update
  *
  * This API updates the attribute value.
@@ -327,6 +347,97 @@ esp_err_t set_callback(callback_t callback);
  */
 esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val);
 
+/** Attribute update item for `update_batch()` */
+typedef struct update_item {
+    /** Endpoint ID of the attribute */
+    uint16_t endpoint_id;
+    /** Cluster ID of the attribute */
+    uint32_t cluster_id;
+    /** Attribute ID of the attribute */
+    uint32_t attribute_id;
+    /** Value. Appropriate elements should be used as per the value type. */
+    esp_matter_attr_val_t val;
+} update_item_t;
+
+/** Attribute batch update
+ *
+ * This API updates multiple attributes, in the given order, with a single Matter stack lock acquisition. The other
+ * tasks and the subscribers do not see the intermediate states. The callbacks are the same as for `update()`.
+ *
+ * @note: All the items are updated even if one of them fails.
+ *
+ * @param[in] items Array of update items.
+ * @param[in] count Number of items.
+ *
+ * @return ESP_OK on success.
+ * @return error of the first failed item in case of failure.
+ */
+esp_err_t update_batch(update_item_t *items, size_t count);
+
+/** Attribute update without waiting
+ *
+ * This API queues the attribute update and returns without taking the Matter stack lock. The queued updates are
+ * applied in batches on the Matter thread, in the same way as `update()`. If the same attribute is updated again
+ * before the queue is drained, only the last value is applied. It can be called from any task, but not from an ISR.
+ *
+ * @note: This can only be called after `esp_matter::start()`. The queue size is
+ * `CONFIG_ESP_MATTER_ATTRIBUTE_UPDATE_QUEUE_SIZE`. Errors while applying the update are only logged.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID of the attribute.
+ * @param[in] val Pointer to `esp_matter_attr_val_t`. Appropriate elements should be used as per the value type. The
+ * string values are copied.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NO_MEM if the queue is full.
+ * @return ESP_ERR_INVALID_STATE if esp_matter has not started.
+ * @return error in case of failure.
+ */
+esp_err_t update_async(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val);
+
+/** Resolved attribute handle */
+typedef size_t resolved_attribute_t;
+
+/** Resolve attribute
+ *
+ * Resolve the attribute path once into a handle, for attributes which are updated repeatedly. The updates through the
+ * handle do not look the attribute up again. The handle stays valid when its endpoint is disabled or the attribute is
+ * destroyed: it is resolved again on the next update, which fails if the attribute does not exist anymore.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID of the attribute.
+ *
+ * @return Resolved attribute handle on success.
+ * @return NULL in case of failure.
+ */
+resolved_attribute_t *resolve(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+
+/** Attribute update with resolved handle
+ *
+ * Same as `update()`, but for the attribute of the resolved handle.
+ *
+ * @param[in] handle Resolved attribute handle.
+ * @param[in] val Pointer to `esp_matter_attr_val_t`. Appropriate elements should be used as per the value type.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_STATE if the attribute does not exist anymore.
+ * @return error in case of failure.
+ */
+esp_err_t update(resolved_attribute_t *handle, esp_matter_attr_val_t *val);
+
+/** Release resolved handle
+ *
+ * Free the resolved attribute handle. It must not be in use by another task.
+ *
+ * @param[in] handle Resolved attribute handle.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t release(resolved_attribute_t *handle);
+
 /** Attribute value print
  *
  * This API prints the attribute value according to the type.
@@ -338,5 +449,35 @@ esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_i
  */
 void val_print(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val);
 
+/** Attribute trace level */
+typedef enum trace_level {
+    /** Nothing is recorded */
+    TRACE_LEVEL_NONE,
+    /** The attribute changes from Matter are recorded */
+    TRACE_LEVEL_CHANGE,
+    /** The attribute reads from Matter are recorded too */
+    TRACE_LEVEL_READ,
+} trace_level_t;
+
+/** Set attribute trace level
+ *
+ * The attribute reads and changes from Matter are recorded in a binary trace ring instead of being printed. This
+ * sets what is recorded. The default is `TRACE_LEVEL_READ`.
+ *
+ * @note: This needs `CONFIG_ESP_MATTER_ATTRIBUTE_TRACE_ENABLE`.
+ *
+ * @param[in] level Trace level.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_SUPPORTED if the trace is disabled in the config.
+ */
+esp_err_t set_trace_level(trace_level_t level);
+
+/** Attribute trace print
+ *
+ * This API decodes and prints the records in the attribute trace ring, from the oldest to the newest.
+ */
+void trace_print();
+
 } /* attribute */
 } /* esp_matter */
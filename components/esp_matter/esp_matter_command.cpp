@@ -39,12 +39,9 @@ void DispatchSingleClusterCommandCommon(const ConcreteCommandPath &command_path,
     uint16_t endpoint_id = command_path.mEndpointId;
     uint32_t cluster_id = command_path.mClusterId;
     uint32_t command_id = command_path.mCommandId;
-    ESP_LOGI(TAG, "Received command 0x%04X for enpoint 0x%04X's cluster 0x%08X", command_id, endpoint_id, cluster_id);
+    ESP_LOGD(TAG, "Received command 0x%04X for enpoint 0x%04X's cluster 0x%08X", command_id, endpoint_id, cluster_id);
 
-    node_t *node = node::get();
-    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
-    cluster_t *cluster = cluster::get(endpoint, cluster_id);
-    command_t *command = get(cluster, command_id, COMMAND_FLAG_ACCEPTED);
+    command_t *command = get(endpoint_id, cluster_id, command_id);
     if (!command) {
         ESP_LOGE(TAG, "Command 0x%04X not found", command_id);
         return;
@@ -12,10 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <esp_heap_caps.h>
 #include <esp_log.h>
 #include <esp_matter.h>
+#include <esp_matter_console.h>
 #include <esp_matter_core.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <nvs.h>
+#include <string.h>
 #include <esp_bt.h>
 #if CONFIG_BT_NIMBLE_ENABLED
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -64,6 +69,10 @@ using chip::DeviceLayer::ThreadStackMgr;
 #define ESP_MATTER_NVS_PART_NAME CONFIG_ESP_MATTER_NVS_PART_NAME
 #define ESP_MATTER_MAX_DEVICE_TYPE_COUNT CONFIG_ESP_MATTER_MAX_DEVICE_TYPE_COUNT
 #define ESP_MATTER_NVS_NODE_NAMESPACE "node"
+#define ESP_MATTER_POOL_VALUE_SIZE 8
+#if CONFIG_ESP_MATTER_MEM_POOL_ENABLE
+#define ESP_MATTER_POOL_CHUNK_SIZE CONFIG_ESP_MATTER_MEM_POOL_CHUNK_SIZE
+#endif
 
 static const char *TAG = "esp_matter_core";
 static bool esp_matter_started = false;
@@ -115,13 +124,66 @@ AppDelegateImpl s_app_delegate;
 
 }  // namespace
 
+/* Bloom filter of the IDs in a list. This is used by get() for skipping the list walk when the ID is certainly not
+in the list, which is the common case for the duplicate check in create(). IDs are never removed from the lists which
+use it, since their elements are only freed together with their parent. */
+typedef uint64_t id_filter_t;
+
+static inline id_filter_t get_id_filter_bit(uint32_t id)
+{
+    /* Fibonacci hashing to 6 bits */
+    return (id_filter_t)1 << ((id * 2654435761u) >> 26);
+}
+
+/* The attribute lists are longer (about 50 attributes for color control), which would fill most of the 64 bits. Their
+filter has 256 bits with 2 bits per ID, so that about 10% of the IDs which are not in such a list still need the walk.
+*/
+#define ATTRIBUTE_ID_FILTER_WORDS 4
+
+typedef struct attribute_id_filter {
+    uint64_t words[ATTRIBUTE_ID_FILTER_WORDS];
+} attribute_id_filter_t;
+
+static inline void attribute_id_filter_add(attribute_id_filter_t *filter, uint32_t id)
+{
+    /* Two independent multiplicative hashes to 8 bits */
+    uint32_t first = (id * 2654435761u) >> 24;
+    uint32_t second = (id * 0x85EBCA6Bu) >> 24;
+    filter->words[first / 64] |= (uint64_t)1 << (first % 64);
+    filter->words[second / 64] |= (uint64_t)1 << (second % 64);
+}
+
+static inline bool attribute_id_filter_may_contain(const attribute_id_filter_t *filter, uint32_t id)
+{
+    uint32_t first = (id * 2654435761u) >> 24;
+    uint32_t second = (id * 0x85EBCA6Bu) >> 24;
+    return (filter->words[first / 64] & ((uint64_t)1 << (first % 64))) &&
+           (filter->words[second / 64] & ((uint64_t)1 << (second % 64)));
+}
+
+typedef struct _update_policy {
+    attribute::update_policy_t policy;
+    int64_t last_update_us;
+    /* The latest update which was held back by the policy. This is applied from the policy timer when the min or max
+    interval expires. The policy is only set for numeric attributes, so the val does not own any buffer. */
+    bool pending;
+    esp_matter_attr_val_t pending_val;
+} _update_policy_t;
+
 typedef struct _attribute {
     uint32_t attribute_id;
     uint32_t cluster_id;
     uint16_t endpoint_id;
     uint16_t flags;
+    bool nvs_dirty;
     esp_matter_attr_val_t val;
+    /* Size of the heap buffer of a string value. This is 0 if the value is stored in val_inline. */
+    uint16_t val_capacity;
+#if CONFIG_ESP_MATTER_ATTRIBUTE_INLINE_VAL_SIZE > 0
+    uint8_t val_inline[CONFIG_ESP_MATTER_ATTRIBUTE_INLINE_VAL_SIZE];
+#endif
     esp_matter_attr_bounds_t *bounds;
+    _update_policy_t *update_policy;
     EmberAfDefaultOrMinMaxAttributeValue default_value;
     uint16_t default_value_size;
     attribute::callback_t override_callback;
@@ -143,29 +205,244 @@ typedef struct _cluster {
     cluster::plugin_server_init_callback_t plugin_server_init_callback;
     cluster::plugin_client_init_callback_t plugin_client_init_callback;
     _attribute_t *attribute_list;
+    _attribute_t *attribute_list_tail;
+    attribute_id_filter_t attribute_id_filter;
     _command_t *command_list;
+    _command_t *command_list_tail;
+    id_filter_t command_id_filter;
     struct _cluster *next;
 } _cluster_t;
 
+typedef struct _command_entry {
+    uint32_t cluster_id;
+    uint32_t command_id;
+    _command_t *command;
+} _command_entry_t;
+
 typedef struct _endpoint {
     uint16_t endpoint_id;
     uint8_t device_type_count;
     uint32_t device_type_ids[ESP_MATTER_MAX_DEVICE_TYPE_COUNT];
     uint8_t device_type_versions[ESP_MATTER_MAX_DEVICE_TYPE_COUNT];
     uint16_t flags;
+    /* Dynamic endpoint index used by the endpoint, 0xFFFF if it is not enabled */
+    uint16_t endpoint_index;
+    bool nvs_dirty;
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    bool nvs_legacy;
+    bool nvs_snapshot_loaded;
+    uint8_t *nvs_snapshot;
+    size_t nvs_snapshot_size;
+#endif
     _cluster_t *cluster_list;
-    EmberAfEndpointType *endpoint_type;
+    _cluster_t *cluster_list_tail;
+    id_filter_t cluster_id_filter;
+    const EmberAfEndpointType *static_endpoint_type;
+    const EmberAfEndpointType *endpoint_type;
     DataVersion *data_versions_ptr;
     EmberAfDeviceType *device_types_ptr;
+    /* Accepted commands sorted by cluster and command ID, while the endpoint is enabled */
+    _command_entry_t *command_table;
+    uint16_t command_count;
     void *priv_data;
     struct _endpoint *next;
 } _endpoint_t;
 
 typedef struct _node {
     _endpoint_t *endpoint_list;
+    _endpoint_t *endpoint_list_tail;
     uint16_t min_unused_endpoint_id;
 } _node_t;
 
+namespace pool {
+
+/* The free objects are linked through their first bytes */
+typedef struct _pool_object {
+    struct _pool_object *next;
+} _pool_object_t;
+
+typedef struct _pool {
+    _pool_object_t *free_list;
+    stats_t stats;
+} _pool_t;
+
+/* This is indexed by type_t */
+static _pool_t pools[TYPE_MAX] = {
+    {NULL, {sizeof(_endpoint_t)}},
+    {NULL, {sizeof(_cluster_t)}},
+    {NULL, {sizeof(_attribute_t)}},
+    {NULL, {sizeof(_command_t)}},
+    {NULL, {sizeof(esp_matter_attr_bounds_t)}},
+    {NULL, {sizeof(EmberAfAttributeMinMaxValue)}},
+    {NULL, {ESP_MATTER_POOL_VALUE_SIZE}},
+};
+
+static portMUX_TYPE pool_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static heap_info_t heap_info_before;
+static heap_info_t heap_info_after;
+
+static void record_alloc(_pool_t *pool)
+{
+    pool->stats.alloc_count++;
+    pool->stats.in_use++;
+    if (pool->stats.in_use > pool->stats.peak) {
+        pool->stats.peak = pool->stats.in_use;
+    }
+}
+
+static void *alloc_object(type_t type)
+{
+    _pool_t *pool = &pools[type];
+#if CONFIG_ESP_MATTER_MEM_POOL_ENABLE
+    portENTER_CRITICAL(&pool_spinlock);
+    _pool_object_t *object = pool->free_list;
+    if (object) {
+        pool->free_list = object->next;
+        record_alloc(pool);
+    }
+    portEXIT_CRITICAL(&pool_spinlock);
+
+    if (!object) {
+        /* Allocate a new chunk outside the critical section. The first object is returned and the rest are added
+        to the free list. */
+        uint8_t *chunk = (uint8_t *)calloc(ESP_MATTER_POOL_CHUNK_SIZE, pool->stats.object_size);
+        if (!chunk) {
+            return NULL;
+        }
+        object = (_pool_object_t *)chunk;
+        portENTER_CRITICAL(&pool_spinlock);
+        for (int i = ESP_MATTER_POOL_CHUNK_SIZE - 1; i > 0; i--) {
+            _pool_object_t *free_entry = (_pool_object_t *)(chunk + i * pool->stats.object_size);
+            free_entry->next = pool->free_list;
+            pool->free_list = free_entry;
+        }
+        pool->stats.heap_alloc_count++;
+        pool->stats.capacity += ESP_MATTER_POOL_CHUNK_SIZE;
+        record_alloc(pool);
+        portEXIT_CRITICAL(&pool_spinlock);
+    }
+    memset(object, 0, pool->stats.object_size);
+    return object;
+#else
+    void *object = calloc(1, pool->stats.object_size);
+    if (object) {
+        portENTER_CRITICAL(&pool_spinlock);
+        pool->stats.heap_alloc_count++;
+        record_alloc(pool);
+        portEXIT_CRITICAL(&pool_spinlock);
+    }
+    return object;
+#endif
+}
+
+static void free_object(type_t type, void *object)
+{
+    if (!object) {
+        return;
+    }
+    _pool_t *pool = &pools[type];
+    portENTER_CRITICAL(&pool_spinlock);
+    pool->stats.free_count++;
+    pool->stats.in_use--;
+#if CONFIG_ESP_MATTER_MEM_POOL_ENABLE
+    _pool_object_t *free_entry = (_pool_object_t *)object;
+    free_entry->next = pool->free_list;
+    pool->free_list = free_entry;
+    portEXIT_CRITICAL(&pool_spinlock);
+#else
+    portEXIT_CRITICAL(&pool_spinlock);
+    free(object);
+#endif
+}
+
+/* Values larger than ESP_MATTER_POOL_VALUE_SIZE (long strings) are allocated from the heap */
+static bool value_is_pooled(uint16_t size)
+{
+    return size <= ESP_MATTER_POOL_VALUE_SIZE;
+}
+
+/* Size taken by a value from alloc_value() */
+static size_t get_value_alloc_size(uint16_t size)
+{
+    return value_is_pooled(size) ? ESP_MATTER_POOL_VALUE_SIZE : size;
+}
+
+static void *alloc_value(uint16_t size)
+{
+    if (value_is_pooled(size)) {
+        return alloc_object(TYPE_VALUE);
+    }
+    return calloc(1, size);
+}
+
+static void free_value(void *value, uint16_t size)
+{
+    if (value_is_pooled(size)) {
+        free_object(TYPE_VALUE, value);
+    } else {
+        free(value);
+    }
+}
+
+static void record_heap_info(heap_info_t *heap_info)
+{
+    heap_info->free_size = heap_caps_get_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    heap_info->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    heap_info->minimum_free_size = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+}
+
+esp_err_t get_stats(type_t type, stats_t *stats)
+{
+    if (type >= TYPE_MAX || !stats) {
+        ESP_LOGE(TAG, "Invalid type or stats cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&pool_spinlock);
+    memcpy(stats, &pools[type].stats, sizeof(stats_t));
+    portEXIT_CRITICAL(&pool_spinlock);
+    return ESP_OK;
+}
+
+esp_err_t get_heap_info(heap_info_t *before, heap_info_t *after)
+{
+    if (before) {
+        memcpy(before, &heap_info_before, sizeof(heap_info_t));
+    }
+    if (after) {
+        memcpy(after, &heap_info_after, sizeof(heap_info_t));
+    }
+    return ESP_OK;
+}
+
+void print_stats()
+{
+    static const char *type_names[TYPE_MAX] = {"endpoint", "cluster", "attribute", "command", "bounds", "min_max",
+                                               "value"};
+#if CONFIG_ESP_MATTER_MEM_POOL_ENABLE
+    printf("Data model pool: enabled, chunk size: %d\n", ESP_MATTER_POOL_CHUNK_SIZE);
+#else
+    printf("Data model pool: disabled\n");
+#endif
+    printf("Type\t\tSize\tIn use\tPeak\tAllocs\tFrees\tHeap\tCapacity\n");
+    for (int type = 0; type < TYPE_MAX; type++) {
+        stats_t stats;
+        get_stats((type_t)type, &stats);
+        printf("%-10s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", type_names[type], stats.object_size, stats.in_use, stats.peak,
+               stats.alloc_count, stats.free_count, stats.heap_alloc_count, stats.capacity);
+    }
+
+    heap_info_t now;
+    record_heap_info(&now);
+    printf("Internal heap\tFree\tLargest Free Block\tMin. Ever Free Size\n");
+    printf("Before\t\t%d\t%d\t\t\t%d\n", heap_info_before.free_size, heap_info_before.largest_free_block,
+           heap_info_before.minimum_free_size);
+    printf("After\t\t%d\t%d\t\t\t%d\n", heap_info_after.free_size, heap_info_after.largest_free_block,
+           heap_info_after.minimum_free_size);
+    printf("Now\t\t%d\t%d\t\t\t%d\n", now.free_size, now.largest_free_block, now.minimum_free_size);
+}
+
+} /* pool */
+
 namespace node {
 
 static _node_t *node = NULL;
@@ -211,471 +488,1822 @@ static esp_err_t read_min_unused_endpoint_id()
 
 } /* node */
 
-namespace cluster {
-static int get_count(_cluster_t *current)
+namespace command {
+/* Fill the IDs of the commands with command_flag at *command_ids, followed by kInvalidCommandId, and advance
+*command_ids. Returns NULL if there are no such commands. */
+static const CommandId *fill_ids(_command_t *current, int command_flag, CommandId **command_ids)
 {
-    int count = 0;
+    CommandId *first = *command_ids;
+    CommandId *next = first;
     while (current) {
+        if (current->flags & command_flag) {
+            *next++ = current->command_id;
+        }
         current = current->next;
-        count++;
     }
-    return count;
+    if (next == first) {
+        return NULL;
+    }
+    *next++ = kInvalidCommandId;
+    *command_ids = next;
+    return first;
 }
-} /* cluster */
 
-namespace command {
-static int get_count(_command_t *current, int command_flag)
+/* Check that ids, which is terminated by kInvalidCommandId (or NULL if empty), has the same commands as the ones
+with command_flag in the list, in any order */
+static bool ids_match(_command_t *list, int command_flag, const CommandId *ids)
 {
-    int count = 0;
-    while (current) {
+    int list_count = 0;
+    for (_command_t *current = list; current; current = current->next) {
         if (current->flags & command_flag) {
-            count++;
+            list_count++;
         }
-        current = current->next;
     }
-    return count;
+    int ids_count = 0;
+    for (; ids && *ids != kInvalidCommandId; ids++) {
+        _command_t *current = list;
+        while (current && !(current->command_id == *ids && (current->flags & command_flag))) {
+            current = current->next;
+        }
+        if (!current) {
+            return false;
+        }
+        ids_count++;
+    }
+    return ids_count == list_count;
 }
-} /* command */
-
-namespace attribute {
-
-extern esp_err_t get_data_from_attr_val(esp_matter_attr_val_t *val, EmberAfAttributeType *attribute_type,
-                                        uint16_t *attribute_size, uint8_t *value);
 
-static int get_count(_attribute_t *current)
+/* Command table
+ *
+ * Sorted array of the accepted commands of an enabled endpoint, so that the incoming commands are dispatched with a
+ * binary search instead of walking the endpoint, cluster and command lists. It is built in endpoint::enable() and
+ * freed in endpoint::disable().
+ */
+static int compare_entries(const void *a, const void *b)
 {
-    int count = 0;
-    while (current) {
-        current = current->next;
-        count++;
+    const _command_entry_t *entry_a = (const _command_entry_t *)a;
+    const _command_entry_t *entry_b = (const _command_entry_t *)b;
+    if (entry_a->cluster_id != entry_b->cluster_id) {
+        return entry_a->cluster_id < entry_b->cluster_id ? -1 : 1;
     }
-    return count;
+    if (entry_a->command_id != entry_b->command_id) {
+        return entry_a->command_id < entry_b->command_id ? -1 : 1;
+    }
+    return 0;
 }
 
-static esp_err_t free_default_value(attribute_t *attribute)
+static esp_err_t build_table(_endpoint_t *endpoint, _command_entry_t **table, uint16_t *count)
 {
-    if (!attribute) {
-        ESP_LOGE(TAG, "Attribute cannot be NULL");
-        return ESP_FAIL;
+    int command_count = 0;
+    for (_cluster_t *cluster = endpoint->cluster_list; cluster; cluster = cluster->next) {
+        for (_command_t *command = cluster->command_list; command; command = command->next) {
+            if (command->flags & COMMAND_FLAG_ACCEPTED) {
+                command_count++;
+            }
+        }
+    }
+    *table = NULL;
+    *count = 0;
+    if (command_count == 0) {
+        return ESP_OK;
     }
-    _attribute_t *current_attribute = (_attribute_t *)attribute;
 
-    /* Free value if data is more than 2 bytes or if it is min max attribute */
-    if (current_attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
-        if (current_attribute->default_value_size > 2) {
-            if (current_attribute->default_value.ptrToMinMaxValue->defaultValue.ptrToDefaultValue) {
-                free((void *)current_attribute->default_value.ptrToMinMaxValue->defaultValue.ptrToDefaultValue);
-            }
-            if (current_attribute->default_value.ptrToMinMaxValue->minValue.ptrToDefaultValue) {
-                free((void *)current_attribute->default_value.ptrToMinMaxValue->minValue.ptrToDefaultValue);
-            }
-            if (current_attribute->default_value.ptrToMinMaxValue->maxValue.ptrToDefaultValue) {
-                free((void *)current_attribute->default_value.ptrToMinMaxValue->maxValue.ptrToDefaultValue);
+    _command_entry_t *entries = (_command_entry_t *)calloc(command_count, sizeof(_command_entry_t));
+    if (!entries) {
+        ESP_LOGE(TAG, "Couldn't allocate the command table");
+        return ESP_ERR_NO_MEM;
+    }
+    int index = 0;
+    for (_cluster_t *cluster = endpoint->cluster_list; cluster; cluster = cluster->next) {
+        for (_command_t *command = cluster->command_list; command; command = command->next) {
+            if (command->flags & COMMAND_FLAG_ACCEPTED) {
+                entries[index].cluster_id = cluster->cluster_id;
+                entries[index].command_id = command->command_id;
+                entries[index].command = command;
+                index++;
             }
         }
-        free((void *)current_attribute->default_value.ptrToMinMaxValue);
-    } else if (current_attribute->default_value_size > 2) {
-        if (current_attribute->default_value.ptrToDefaultValue) {
-            free((void *)current_attribute->default_value.ptrToDefaultValue);
-        }
     }
+    qsort(entries, command_count, sizeof(_command_entry_t), compare_entries);
+    *table = entries;
+    *count = command_count;
     return ESP_OK;
 }
 
-static EmberAfDefaultAttributeValue get_default_value_from_data(esp_matter_attr_val_t *val,
-                                                                EmberAfAttributeType attribute_type,
-                                                                uint16_t attribute_size)
+static _command_t *table_find(_endpoint_t *endpoint, uint32_t cluster_id, uint32_t command_id)
 {
-    EmberAfDefaultAttributeValue default_value = (uint16_t)0;
-    uint8_t *value = (uint8_t *)calloc(1, attribute_size);
-    if (!value) {
-        ESP_LOGE(TAG, "Could not allocate value buffer for default value");
-        return default_value;
-    }
-    get_data_from_attr_val(val, &attribute_type, &attribute_size, value);
-
-    if (attribute_size > 2) {
-        /* Directly set the pointer */
-        default_value = value;
-    } else {
-        /* This data is 2 bytes or less. This should be represented as uint16. Copy the bytes appropriately
-        for 0 or 1 or 2 bytes to be converted to uint16. Then free the allocated buffer. */
-        uint16_t int_value = 0;
-        if (attribute_size == 2) {
-            memcpy(&int_value, value, attribute_size);
-        } else if (attribute_size == 1) {
-            int_value = (uint16_t)*value;
+    const _command_entry_t *table = endpoint->command_table;
+    int low = 0;
+    int high = (int)endpoint->command_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const _command_entry_t *entry = &table[mid];
+        if (entry->cluster_id == cluster_id && entry->command_id == command_id) {
+            return entry->command;
+        }
+        if (entry->cluster_id < cluster_id || (entry->cluster_id == cluster_id && entry->command_id < command_id)) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
         }
-        default_value = int_value;
-        free(value);
     }
-    return default_value;
+    return NULL;
 }
+} /* command */
 
-static esp_err_t set_default_value_from_current_val(attribute_t *attribute)
-{
-    if (!attribute) {
-        ESP_LOGE(TAG, "Attribute cannot be NULL");
-        return ESP_FAIL;
-    }
-    _attribute_t *current_attribute = (_attribute_t *)attribute;
-    esp_matter_attr_val_t *val = &current_attribute->val;
+namespace attribute {
 
-    /* Get size */
-    EmberAfAttributeType attribute_type = 0;
-    uint16_t attribute_size = 0;
-    get_data_from_attr_val(val, &attribute_type, &attribute_size, NULL);
+extern esp_err_t get_data_from_attr_val(esp_matter_attr_val_t *val, EmberAfAttributeType *attribute_type,
+                                        uint16_t *attribute_size, uint8_t *value);
+extern esp_err_t get_val_as_double(esp_matter_attr_val_t *val, double *value);
+extern bool val_is_null(esp_matter_attr_val_t *val);
+/* This must be called with the chip stack lock held */
+extern esp_err_t update_locked(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                               esp_matter_attr_val_t *val);
+
+
+/* Attribute index
+ *
+ * Open addressing hash table (linear probing) of the attributes of the enabled endpoints, keyed on
+ * (endpoint_id, cluster_id, attribute_id). This is used for resolving the attributes in the external read/write
+ * callbacks without walking the endpoint, cluster and attribute lists. Entries are added in endpoint::enable() and
+ * removed in endpoint::disable(), both with the chip stack lock held.
+ */
+#define ATTRIBUTE_INDEX_MIN_SIZE 64
 
-    /* Get and set value */
-    if (current_attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
-        EmberAfAttributeMinMaxValue *temp_value = (EmberAfAttributeMinMaxValue *)calloc(1,
-                                                                                sizeof(EmberAfAttributeMinMaxValue));
-        if (!temp_value) {
-            ESP_LOGE(TAG, "Could not allocate ptrToMinMaxValue for default value");
-            return ESP_FAIL;
-        }
-        temp_value->defaultValue = get_default_value_from_data(val, attribute_type, attribute_size);
-        temp_value->minValue = get_default_value_from_data(&current_attribute->bounds->min, attribute_type,
-                                                           attribute_size);
-        temp_value->maxValue = get_default_value_from_data(&current_attribute->bounds->max, attribute_type,
-                                                           attribute_size);
-        current_attribute->default_value.ptrToMinMaxValue = temp_value;
-    } else if (attribute_size > 2) {
-        EmberAfDefaultAttributeValue temp_value = get_default_value_from_data(val, attribute_type, attribute_size);
-        current_attribute->default_value.ptrToDefaultValue = temp_value.ptrToDefaultValue;
-    } else {
-        EmberAfDefaultAttributeValue temp_value = get_default_value_from_data(val, attribute_type, attribute_size);
-        current_attribute->default_value.defaultValue = temp_value.defaultValue;
-    }
-    current_attribute->default_value_size = attribute_size;
-    return ESP_OK;
-}
-} /* attribute */
+typedef struct _attribute_index {
+    _attribute_t **table;
+    uint32_t size; /* Always a power of 2 */
+    uint32_t count;
+} _attribute_index_t;
 
-namespace endpoint {
+static _attribute_index_t attribute_index;
 
-static int get_next_index()
+static uint32_t index_hash(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
 {
-    uint16_t endpoint_id = 0;
-    for (int index = 0; index < MAX_ENDPOINT_COUNT; index++) {
-        endpoint_id = emberAfEndpointFromIndex(index);
-        if (endpoint_id == kInvalidEndpointId) {
-            return index;
-        }
-    }
-    return 0xFFFF;
+    uint32_t hash = endpoint_id;
+    hash = (hash * 0x9E3779B1) ^ cluster_id;
+    hash = (hash * 0x9E3779B1) ^ attribute_id;
+    /* Final avalanche so that the low bits used for the slot depend on all the inputs */
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6B;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35;
+    hash ^= hash >> 16;
+    return hash;
 }
 
-static esp_err_t disable(endpoint_t *endpoint)
+static uint32_t index_slot(_attribute_t *attribute)
 {
-    if (!endpoint) {
-        ESP_LOGE(TAG, "Endpoint cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
-    }
+    return index_hash(attribute->endpoint_id, attribute->cluster_id, attribute->attribute_id) &
+           (attribute_index.size - 1);
+}
 
-    /* Take lock if not already taken */
-    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY);
-    if (lock_status == lock::FAILED) {
-        ESP_LOGE(TAG, "Could not get task context");
-        return ESP_FAIL;
+static esp_err_t index_resize(uint32_t new_size)
+{
+    _attribute_t **new_table = (_attribute_t **)calloc(new_size, sizeof(_attribute_t *));
+    if (!new_table) {
+        ESP_LOGE(TAG, "Couldn't allocate attribute index");
+        return ESP_ERR_NO_MEM;
     }
-
-    /* Remove endpoint */
-    _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
-    int endpoint_index = emberAfGetDynamicIndexFromEndpoint(current_endpoint->endpoint_id);
-    if (endpoint_index == 0xFFFF) {
-        ESP_LOGE(TAG, "Could not find endpoint index");
-        if (lock_status == lock::SUCCESS) {
-            lock::chip_stack_unlock();
+    _attribute_t **old_table = attribute_index.table;
+    uint32_t old_size = attribute_index.size;
+    attribute_index.table = new_table;
+    attribute_index.size = new_size;
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (old_table[i]) {
+            uint32_t slot = index_slot(old_table[i]);
+            while (new_table[slot]) {
+                slot = (slot + 1) & (new_size - 1);
+            }
+            new_table[slot] = old_table[i];
         }
-        return ESP_FAIL;
     }
-    emberAfClearDynamicEndpoint(endpoint_index);
+    free(old_table);
+    return ESP_OK;
+}
 
-    if (lock_status == lock::SUCCESS) {
-        lock::chip_stack_unlock();
+static esp_err_t index_add(_attribute_t *attribute)
+{
+    /* Keep the load factor below 3/4 */
+    if ((attribute_index.count + 1) * 4 > attribute_index.size * 3) {
+        uint32_t new_size = attribute_index.size ? attribute_index.size * 2 : ATTRIBUTE_INDEX_MIN_SIZE;
+        esp_err_t err = index_resize(new_size);
+        if (err != ESP_OK) {
+            return err;
+        }
     }
-    if (!(current_endpoint->endpoint_type)) {
-        ESP_LOGE(TAG, "endpoint %d's endpoint_type is NULL", current_endpoint->endpoint_id);
-        return ESP_ERR_INVALID_STATE;
+    uint32_t slot = index_slot(attribute);
+    while (attribute_index.table[slot]) {
+        if (attribute_index.table[slot] == attribute) {
+            return ESP_OK;
+        }
+        slot = (slot + 1) & (attribute_index.size - 1);
     }
-    /* Free all clusters */
-    EmberAfEndpointType *endpoint_type = current_endpoint->endpoint_type;
-    int cluster_count = endpoint_type->clusterCount;
-    for (int cluster_index = 0; cluster_index < cluster_count; cluster_index++) {
-        /* Free attributes */
-        free((void *)endpoint_type->cluster[cluster_index].attributes);
-        /* Free commands */
-        if (endpoint_type->cluster[cluster_index].acceptedCommandList) {
-            free((void *)endpoint_type->cluster[cluster_index].acceptedCommandList);
+    attribute_index.table[slot] = attribute;
+    attribute_index.count++;
+    return ESP_OK;
+}
+
+static void index_remove(_attribute_t *attribute)
+{
+    if (attribute_index.count == 0) {
+        return;
+    }
+    uint32_t mask = attribute_index.size - 1;
+    uint32_t slot = index_slot(attribute);
+    while (attribute_index.table[slot] != attribute) {
+        if (!attribute_index.table[slot]) {
+            /* Not indexed */
+            return;
         }
-        if (endpoint_type->cluster[cluster_index].generatedCommandList) {
-            free((void *)endpoint_type->cluster[cluster_index].generatedCommandList);
+        slot = (slot + 1) & mask;
+    }
+
+    /* Backward shift deletion, so that no tombstones are needed for the lookups */
+    uint32_t next = slot;
+    while (true) {
+        attribute_index.table[slot] = NULL;
+        while (true) {
+            next = (next + 1) & mask;
+            if (!attribute_index.table[next]) {
+                attribute_index.count--;
+                return;
+            }
+            uint32_t home = index_slot(attribute_index.table[next]);
+            /* The entry can stay if its home slot is cyclically in (slot, next] */
+            bool stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+            if (!stays) {
+                break;
+            }
         }
+        attribute_index.table[slot] = attribute_index.table[next];
+        slot = next;
     }
-    free((void *)endpoint_type->cluster);
+}
 
-    /* Free data versions */
-    if (current_endpoint->data_versions_ptr) {
-        free(current_endpoint->data_versions_ptr);
-        current_endpoint->data_versions_ptr = NULL;
+static _attribute_t *index_find(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    if (attribute_index.count == 0) {
+        return NULL;
     }
-
-    /* Free device types */
-    if (current_endpoint->device_types_ptr) {
-        free(current_endpoint->device_types_ptr);
-        current_endpoint->device_types_ptr = NULL;
+    uint32_t mask = attribute_index.size - 1;
+    uint32_t slot = index_hash(endpoint_id, cluster_id, attribute_id) & mask;
+    _attribute_t *current_attribute = attribute_index.table[slot];
+    while (current_attribute) {
+        if (current_attribute->attribute_id == attribute_id && current_attribute->cluster_id == cluster_id &&
+            current_attribute->endpoint_id == endpoint_id) {
+            return current_attribute;
+        }
+        slot = (slot + 1) & mask;
+        current_attribute = attribute_index.table[slot];
     }
-
-    /* Free endpoint type */
-    free(endpoint_type);
-    current_endpoint->endpoint_type = NULL;
-    return ESP_OK;
+    return NULL;
 }
 
-esp_err_t enable(endpoint_t *endpoint, uint16_t parent_endpoint_id)
-{
-    if (!endpoint) {
-        ESP_LOGE(TAG, "Endpoint cannot be NULL");
-        return ESP_ERR_INVALID_ARG;
-    }
-    _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
+/* Data model generation for the attribute caches. This changes whenever an attribute is destroyed or an endpoint is
+enabled or disabled. */
+static uint32_t cache_generation = 0;
+static portMUX_TYPE cache_spinlock = portMUX_INITIALIZER_UNLOCKED;
 
-    /* Endpoint Type */
-    EmberAfEndpointType *endpoint_type = (EmberAfEndpointType *)calloc(1, sizeof(EmberAfEndpointType));
-    if (!endpoint_type) {
-        ESP_LOGE(TAG, "Couldn't allocate endpoint_type");
-        /* goto cleanup is not used here to avoid 'crosses initialization' of data_versions below */
-        return ESP_ERR_NO_MEM;
-    }
-    current_endpoint->endpoint_type = endpoint_type;
+static void invalidate_caches()
+{
+    portENTER_CRITICAL(&cache_spinlock);
+    cache_generation++;
+    portEXIT_CRITICAL(&cache_spinlock);
+}
 
-    /* Device types */
-    EmberAfDeviceType *device_types_ptr = (EmberAfDeviceType *)calloc(current_endpoint->device_type_count, sizeof(EmberAfDeviceType));
-    if (!device_types_ptr) {
-        ESP_LOGE(TAG, "Couldn't allocate device_types");
-        free(endpoint_type);
-        current_endpoint->endpoint_type = NULL;
-        /* goto cleanup is not used here to avoid 'crosses initialization' of device_types below */
-        return ESP_ERR_NO_MEM;
+/* Grow the index so that count more attributes can be added without resizing it again */
+static esp_err_t index_reserve(uint32_t count)
+{
+    uint32_t new_size = attribute_index.size ? attribute_index.size : ATTRIBUTE_INDEX_MIN_SIZE;
+    while ((attribute_index.count + count) * 4 > new_size * 3) {
+        new_size *= 2;
     }
-    for (size_t i = 0; i < current_endpoint->device_type_count; ++i) {
-        device_types_ptr[i].deviceId = current_endpoint->device_type_ids[i];
-        device_types_ptr[i].deviceVersion = current_endpoint->device_type_versions[i];
+    if (new_size == attribute_index.size) {
+        return ESP_OK;
     }
-    chip::Span<EmberAfDeviceType> device_types(device_types_ptr, current_endpoint->device_type_count);
-    current_endpoint->device_types_ptr = device_types_ptr;
+    return index_resize(new_size);
+}
 
-    /* Clusters */
-    _cluster_t *cluster = current_endpoint->cluster_list;
-    int cluster_count = cluster::get_count(cluster);
-    int cluster_index = 0;
+static esp_err_t index_add_endpoint(_endpoint_t *endpoint)
+{
+    _cluster_t *cluster = endpoint->cluster_list;
+    while (cluster) {
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            esp_err_t err = index_add(attribute);
+            if (err != ESP_OK) {
+                return err;
+            }
+            attribute = attribute->next;
+        }
+        cluster = cluster->next;
+    }
+    return ESP_OK;
+}
 
-    DataVersion *data_versions_ptr = (DataVersion *)calloc(1, cluster_count * sizeof(DataVersion));
-    if (!data_versions_ptr) {
-        ESP_LOGE(TAG, "Couldn't allocate data_versions");
-        free(data_versions_ptr);
-        free(endpoint_type);
-        current_endpoint->data_versions_ptr = NULL;
-        current_endpoint->endpoint_type = NULL;
-        /* goto cleanup is not used here to avoid 'crosses initialization' of data_versions below */
-        return ESP_ERR_NO_MEM;
+static void index_remove_endpoint(_endpoint_t *endpoint)
+{
+    _cluster_t *cluster = endpoint->cluster_list;
+    while (cluster) {
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            index_remove(attribute);
+            attribute = attribute->next;
+        }
+        cluster = cluster->next;
     }
-    chip::Span<chip::DataVersion> data_versions(data_versions_ptr, cluster_count);
-    current_endpoint->data_versions_ptr = data_versions_ptr;
+}
 
-    /* Variables */
-    /* This is needed to avoid 'crosses initialization' errors because of goto */
-    esp_err_t err = ESP_OK;
-    lock::status_t lock_status = lock::FAILED;
-    EmberAfStatus status = EMBER_ZCL_STATUS_SUCCESS;
-    EmberAfCluster *matter_clusters = NULL;
-    _attribute_t *attribute = NULL;
-    int attribute_count = 0;
-    int attribute_index = 0;
-    EmberAfAttributeMetadata *matter_attributes = NULL;
-    CommandId *accepted_command_ids = NULL;
-    CommandId *generated_command_ids = NULL;
-    _command_t *command = NULL;
-    int command_count = 0;
-    int command_index = 0;
-    int command_flag = COMMAND_FLAG_NONE;
-    int endpoint_index = 0;
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE || CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+static _endpoint_t *get_endpoint(uint16_t endpoint_id)
+{
+    _endpoint_t *endpoint = node::node ? node::node->endpoint_list : NULL;
+    while (endpoint) {
+        if (endpoint->endpoint_id == endpoint_id) {
+            return endpoint;
+        }
+        endpoint = endpoint->next;
+    }
+    return NULL;
+}
+#endif
 
-    matter_clusters = (EmberAfCluster *)calloc(1, cluster_count * sizeof(EmberAfCluster));
-    if (!matter_clusters) {
-        ESP_LOGE(TAG, "Couldn't allocate matter_clusters");
-        err = ESP_ERR_NO_MEM;
-        goto cleanup;
+static bool is_string_type(esp_matter_val_type_t type)
+{
+    return type == ESP_MATTER_VAL_TYPE_CHAR_STRING || type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
+           type == ESP_MATTER_VAL_TYPE_ARRAY;
+}
+
+/* Check if the val is the same as the current val of the attribute, so that the write can be skipped. The
+attributes with ATTRIBUTE_FLAG_OVERRIDE, whose val is not maintained here, and ATTRIBUTE_FLAG_WRITE_ALWAYS are
+always written. */
+static bool val_is_unchanged(_attribute_t *attribute, esp_matter_attr_val_t *val)
+{
+    if ((attribute->flags & (ATTRIBUTE_FLAG_OVERRIDE | ATTRIBUTE_FLAG_WRITE_ALWAYS)) ||
+        attribute->val.type != val->type) {
+        return false;
+    }
+    if (is_string_type(val->type)) {
+        uint16_t size = val->val.a.s;
+        if (size > 0 && !attribute->val.val.a.b) {
+            return false;
+        }
+        return attribute->val.val.a.s == size && attribute->val.val.a.n == val->val.a.n &&
+               (size == 0 || memcmp(attribute->val.val.a.b, val->val.a.b, size) == 0);
+    }
+    uint16_t size = 0;
+    get_data_from_attr_val(val, NULL, &size, NULL);
+    return size > 0 && memcmp(&attribute->val.val, &val->val, size) == 0;
+}
+
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+/* NVS snapshot
+ *
+ * With CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE, all the NONVOLATILE attributes of an endpoint are stored in a single
+ * blob in the "endpoint_%X" namespace, instead of one "%X:%X" key per attribute. The blob is read once per endpoint
+ * when its first NONVOLATILE attribute is created, and freed when the endpoint is enabled. If the blob is not found,
+ * the values are read from the per attribute keys, which are erased when the blob is stored.
+ *
+ * Blob layout (little endian): a _snapshot_header_t followed by a _snapshot_record_t and its data for each attribute.
+ * The data is the buffer for strings and arrays, and the 8 bytes of the value for the other types.
+ */
+#define ESP_MATTER_NVS_SNAPSHOT_KEY "snapshot"
+#define ESP_MATTER_NVS_SNAPSHOT_VERSION 1
+#define ESP_MATTER_NVS_SNAPSHOT_SCALAR_SIZE sizeof(uint64_t)
+
+typedef struct __attribute__((packed)) _snapshot_header {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t count;
+} _snapshot_header_t;
+
+typedef struct __attribute__((packed)) _snapshot_record {
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t size;
+} _snapshot_record_t;
+
+static uint16_t get_snapshot_data_size(_attribute_t *attribute)
+{
+    if (is_string_type(attribute->val.type)) {
+        return attribute->val.val.a.b ? attribute->val.val.a.s : 0;
     }
+    return ESP_MATTER_NVS_SNAPSHOT_SCALAR_SIZE;
+}
 
+static esp_err_t store_snapshot(nvs_handle_t handle, _endpoint_t *endpoint)
+{
+    /* Get size */
+    size_t size = sizeof(_snapshot_header_t);
+    uint16_t count = 0;
+    _cluster_t *cluster = endpoint->cluster_list;
     while (cluster) {
-        /* Attributes */
-        attribute = cluster->attribute_list;
-        attribute_count = attribute::get_count(attribute);
-        attribute_index = 0;
-        matter_attributes = (EmberAfAttributeMetadata *)calloc(1, attribute_count * sizeof(EmberAfAttributeMetadata));
-        if (!matter_attributes) {
-            if (attribute_count != 0) {
-                ESP_LOGE(TAG, "Couldn't allocate matter_attributes");
-                err = ESP_ERR_NO_MEM;
-                break;
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            if (attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
+                size += sizeof(_snapshot_record_t) + get_snapshot_data_size(attribute);
+                count++;
             }
+            attribute = attribute->next;
         }
+        cluster = cluster->next;
+    }
 
-        while (attribute) {
-            matter_attributes[attribute_index].attributeId = attribute->attribute_id;
-            matter_attributes[attribute_index].mask = attribute->flags;
-            matter_attributes[attribute_index].defaultValue = attribute->default_value;
-            attribute::get_data_from_attr_val(&attribute->val, &matter_attributes[attribute_index].attributeType,
-                                              &matter_attributes[attribute_index].size, NULL);
+    uint8_t *buffer = (uint8_t *)calloc(1, size);
+    if (!buffer) {
+        ESP_LOGE(TAG, "Could not allocate the snapshot buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    _snapshot_header_t header = {
+        .version = ESP_MATTER_NVS_SNAPSHOT_VERSION,
+        .reserved = 0,
+        .count = count,
+    };
+    memcpy(buffer, &header, sizeof(header));
 
-            matter_clusters[cluster_index].clusterSize += matter_attributes[attribute_index].size;
-            attribute = attribute->next;
-            attribute_index++;
-        }
-
-        /* Commands */
-        command = NULL;
-        command_count = 0;
-        command_index = 0;
-        command_flag = COMMAND_FLAG_NONE;
-        accepted_command_ids = NULL;
-        generated_command_ids = NULL;
-
-        /* Client Generated Commands */
-        command_flag = COMMAND_FLAG_ACCEPTED;
-        command = cluster->command_list;
-        command_count = command::get_count(command, command_flag);
-        if (command_count > 0) {
-            command_index = 0;
-            accepted_command_ids = (CommandId *)calloc(1, (command_count + 1) * sizeof(CommandId));
-            if (!accepted_command_ids) {
-                ESP_LOGE(TAG, "Couldn't allocate accepted_command_ids");
-                err = ESP_ERR_NO_MEM;
-                break;
+    /* Fill */
+    size_t offset = sizeof(_snapshot_header_t);
+    cluster = endpoint->cluster_list;
+    while (cluster) {
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            if (attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
+                _snapshot_record_t record = {
+                    .cluster_id = attribute->cluster_id,
+                    .attribute_id = attribute->attribute_id,
+                    .type = (uint8_t)attribute->val.type,
+                    .reserved = 0,
+                    .size = get_snapshot_data_size(attribute),
+                };
+                memcpy(buffer + offset, &record, sizeof(record));
+                offset += sizeof(record);
+                if (is_string_type(attribute->val.type)) {
+                    memcpy(buffer + offset, attribute->val.val.a.b, record.size);
+                } else {
+                    memcpy(buffer + offset, &attribute->val.val.u64, record.size);
+                }
+                offset += record.size;
+                attribute->nvs_dirty = false;
             }
-            while (command) {
-                if (command->flags & command_flag) {
-                    accepted_command_ids[command_index] = command->command_id;
-                    command_index++;
+            attribute = attribute->next;
+        }
+        cluster = cluster->next;
+    }
+    esp_err_t err = nvs_set_blob(handle, ESP_MATTER_NVS_SNAPSHOT_KEY, buffer, size);
+    free(buffer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* Migration: the per attribute keys are not needed anymore */
+    if (endpoint->nvs_legacy) {
+        cluster = endpoint->cluster_list;
+        while (cluster) {
+            _attribute_t *attribute = cluster->attribute_list;
+            while (attribute) {
+                if (attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
+                    char attribute_key[16] = {0};
+                    snprintf(attribute_key, 16, "%X:%X", attribute->cluster_id, attribute->attribute_id);
+                    nvs_erase_key(handle, attribute_key);
                 }
-                command = command->next;
+                attribute = attribute->next;
             }
-            accepted_command_ids[command_index] = kInvalidCommandId;
-        }
-
-        /* Server Generated Commands */
-        command_flag = COMMAND_FLAG_GENERATED;
-        command = cluster->command_list;
-        command_count = command::get_count(command, command_flag);
-        if (command_count > 0) {
-            command_index = 0;
-            generated_command_ids = (CommandId *)calloc(1, (command_count + 1) * sizeof(CommandId));
-            if (!generated_command_ids) {
-                ESP_LOGE(TAG, "Couldn't allocate generated_command_ids");
-                err = ESP_ERR_NO_MEM;
-                break;
+            cluster = cluster->next;
+        }
+        endpoint->nvs_legacy = false;
+        ESP_LOGI(TAG, "Migrated the nonvolatile attributes of endpoint 0x%x to a snapshot", endpoint->endpoint_id);
+    }
+    return ESP_OK;
+}
+
+static void load_snapshot(_endpoint_t *endpoint)
+{
+    endpoint->nvs_snapshot_loaded = true;
+    char nvs_namespace[16] = {0};
+    snprintf(nvs_namespace, 16, "endpoint_%X", endpoint->endpoint_id); /* endpoint_id */
+
+    nvs_handle_t handle;
+    if (nvs_open_from_partition(ESP_MATTER_NVS_PART_NAME, nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t size = 0;
+    if (nvs_get_blob(handle, ESP_MATTER_NVS_SNAPSHOT_KEY, NULL, &size) == ESP_OK &&
+        size >= sizeof(_snapshot_header_t)) {
+        uint8_t *buffer = (uint8_t *)malloc(size);
+        if (buffer && nvs_get_blob(handle, ESP_MATTER_NVS_SNAPSHOT_KEY, buffer, &size) == ESP_OK &&
+            buffer[0] == ESP_MATTER_NVS_SNAPSHOT_VERSION) {
+            endpoint->nvs_snapshot = buffer;
+            endpoint->nvs_snapshot_size = size;
+        } else {
+            ESP_LOGW(TAG, "Ignoring the invalid snapshot of endpoint 0x%x", endpoint->endpoint_id);
+            free(buffer);
+        }
+    }
+    nvs_close(handle);
+}
+
+static void free_snapshot(_endpoint_t *endpoint)
+{
+    free(endpoint->nvs_snapshot);
+    endpoint->nvs_snapshot = NULL;
+    endpoint->nvs_snapshot_size = 0;
+    endpoint->nvs_snapshot_loaded = false;
+}
+
+static esp_err_t get_val_from_snapshot(_endpoint_t *endpoint, _attribute_t *attribute, esp_matter_attr_val_t *val)
+{
+    _snapshot_header_t header;
+    memcpy(&header, endpoint->nvs_snapshot, sizeof(header));
+    size_t offset = sizeof(header);
+    for (uint16_t i = 0; i < header.count; i++) {
+        _snapshot_record_t record;
+        if (offset + sizeof(record) > endpoint->nvs_snapshot_size) {
+            break;
+        }
+        memcpy(&record, endpoint->nvs_snapshot + offset, sizeof(record));
+        offset += sizeof(record);
+        if (offset + record.size > endpoint->nvs_snapshot_size) {
+            break;
+        }
+        if (record.cluster_id == attribute->cluster_id && record.attribute_id == attribute->attribute_id) {
+            if (record.type != attribute->val.type) {
+                ESP_LOGW(TAG, "Type mismatch for attribute 0x%x:0x%x in the snapshot", record.cluster_id,
+                         record.attribute_id);
+                return ESP_ERR_INVALID_STATE;
             }
-            while (command) {
-                if (command->flags & command_flag) {
-                    generated_command_ids[command_index] = command->command_id;
-                    command_index++;
+            val->type = attribute->val.type;
+            if (is_string_type(attribute->val.type)) {
+                /* The buffer is allocated as in get_val_from_nvs() */
+                uint8_t *buffer = (uint8_t *)calloc(1, record.size ? record.size : 1);
+                if (!buffer) {
+                    return ESP_ERR_NO_MEM;
                 }
-                command = command->next;
+                memcpy(buffer, endpoint->nvs_snapshot + offset, record.size);
+                val->val.a.b = buffer;
+                val->val.a.s = record.size;
+                val->val.a.n = record.size;
+                val->val.a.t = record.size + (attribute->val.val.a.t - attribute->val.val.a.s);
+            } else {
+                memcpy(&val->val.u64, endpoint->nvs_snapshot + offset,
+                       record.size < ESP_MATTER_NVS_SNAPSHOT_SCALAR_SIZE ? record.size
+                                                                         : ESP_MATTER_NVS_SNAPSHOT_SCALAR_SIZE);
             }
-            generated_command_ids[command_index] = kInvalidCommandId;
+            return ESP_OK;
+        }
+        offset += record.size;
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+#endif /* CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE */
+
+/* Used when the attribute is created. With the snapshot, the endpoint's blob is used. Otherwise, or for the
+endpoints which do not have a blob yet, the value is read from the per attribute key. */
+static esp_err_t restore_val(_attribute_t *attribute, esp_matter_attr_val_t *val)
+{
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    _endpoint_t *endpoint = get_endpoint(attribute->endpoint_id);
+    if (endpoint) {
+        if (!endpoint->nvs_snapshot_loaded) {
+            load_snapshot(endpoint);
+        }
+        if (endpoint->nvs_snapshot) {
+            return get_val_from_snapshot(endpoint, attribute, val);
+        }
+        esp_err_t err = get_val_from_nvs((attribute_t *)attribute, val);
+        if (err == ESP_OK) {
+            /* Store the snapshot, which also erases the per attribute keys */
+            endpoint->nvs_legacy = true;
+            endpoint->nvs_dirty = true;
+        }
+        return err;
+    }
+#endif
+    return get_val_from_nvs((attribute_t *)attribute, val);
+}
+
+/* NVS write-behind
+ *
+ * With CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE, set_val() only marks the NONVOLATILE attribute and its endpoint as
+ * dirty. The dirty attributes are written with one commit per endpoint namespace, on the chip thread, at most
+ * CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_DELAY_MS after the first change, at shutdown, or when flush_nvs() is called.
+ */
+static esp_err_t store_val(nvs_handle_t handle, _attribute_t *attribute)
+{
+    char attribute_key[16] = {0};
+    snprintf(attribute_key, 16, "%X:%X", attribute->cluster_id, attribute->attribute_id); /* cluster_id:attribute_id */
+    ESP_LOGD(TAG, "strore attribute in nvs: endpoint_id-0x%x, cluster_id-0x%x, attribute_id-0x%x",
+             attribute->endpoint_id, attribute->cluster_id, attribute->attribute_id);
+    attribute->nvs_dirty = false;
+    if (attribute->val.type == ESP_MATTER_VAL_TYPE_CHAR_STRING ||
+        attribute->val.type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
+        attribute->val.type == ESP_MATTER_VAL_TYPE_ARRAY) {
+        /* Store only if value is not NULL */
+        if (attribute->val.val.a.b) {
+            return nvs_set_blob(handle, attribute_key, attribute->val.val.a.b, attribute->val.val.a.s);
         }
+        return ESP_OK;
+    }
+    return nvs_set_blob(handle, attribute_key, &attribute->val, sizeof(esp_matter_attr_val_t));
+}
 
-        /* Fill up the cluster */
-        matter_clusters[cluster_index].clusterId = cluster->cluster_id;
-        matter_clusters[cluster_index].attributes = matter_attributes;
-        matter_clusters[cluster_index].attributeCount = attribute_count;
-        matter_clusters[cluster_index].mask = cluster->flags;
-        matter_clusters[cluster_index].functions = (EmberAfGenericClusterFunction *)cluster->function_list;
-        matter_clusters[cluster_index].acceptedCommandList = accepted_command_ids;
-        matter_clusters[cluster_index].generatedCommandList = generated_command_ids;
+static esp_err_t flush_endpoint_nvs(_endpoint_t *endpoint)
+{
+    if (!endpoint->nvs_dirty) {
+        return ESP_OK;
+    }
+    char nvs_namespace[16] = {0};
+    snprintf(nvs_namespace, 16, "endpoint_%X", endpoint->endpoint_id); /* endpoint_id */
 
-        /* Get next cluster */
-        endpoint_type->endpointSize += matter_clusters[cluster_index].clusterSize;
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open_from_partition(ESP_MATTER_NVS_PART_NAME, nvs_namespace, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening partition: %s, %d", nvs_namespace, err);
+        return err;
+    }
+    /* The endpoint stays dirty if anything could not be stored, so that the next flush retries it */
+    endpoint->nvs_dirty = false;
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    err = store_snapshot(handle, endpoint);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error storing the snapshot of endpoint 0x%x in nvs: %d", endpoint->endpoint_id, err);
+    } else {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        endpoint->nvs_dirty = true;
+    }
+    return err;
+#else
+    int count = 0;
+    _cluster_t *cluster = endpoint->cluster_list;
+    while (cluster) {
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            if (attribute->nvs_dirty) {
+                esp_err_t store_err = store_val(handle, attribute);
+                if (store_err != ESP_OK) {
+                    ESP_LOGE(TAG, "Error storing attribute 0x%x:0x%x in nvs: %d", attribute->cluster_id,
+                             attribute->attribute_id, store_err);
+                    attribute->nvs_dirty = true;
+                    err = store_err;
+                }
+                count++;
+            }
+            attribute = attribute->next;
+        }
         cluster = cluster->next;
-        cluster_index++;
+    }
+    esp_err_t commit_err = nvs_commit(handle);
+    nvs_close(handle);
+    if (commit_err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing endpoint 0x%x to nvs: %d", endpoint->endpoint_id, commit_err);
+        err = commit_err;
+    }
+    if (err != ESP_OK) {
+        endpoint->nvs_dirty = true;
+    }
+    ESP_LOGD(TAG, "Flushed %d attributes of endpoint 0x%x to nvs", count, endpoint->endpoint_id);
+    return err;
+#endif
+}
+
+static esp_err_t flush_all_nvs()
+{
+    if (!node::node) {
+        return ESP_OK;
+    }
+    esp_err_t err = ESP_OK;
+    _endpoint_t *endpoint = node::node->endpoint_list;
+    while (endpoint) {
+        esp_err_t endpoint_err = flush_endpoint_nvs(endpoint);
+        if (endpoint_err != ESP_OK) {
+            err = endpoint_err;
+        }
+        endpoint = endpoint->next;
+    }
+    return err;
+}
+
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE
+static esp_timer_handle_t nvs_flush_timer = NULL;
+static void nvs_flush_timer_start();
+
+static void nvs_flush_work(intptr_t context)
+{
+    /* The endpoints which could not be stored are still dirty, so retry them after the delay */
+    if (flush_all_nvs() != ESP_OK) {
+        nvs_flush_timer_start();
+    }
+}
+
+static void nvs_flush_timer_cb(void *arg)
+{
+    /* Flush on the chip thread, so that the attributes are not changed while they are being stored */
+    PlatformMgr().ScheduleWork(nvs_flush_work, 0);
+}
+
+static void nvs_flush_timer_start()
+{
+    /* Before start, the flush is scheduled by start() itself */
+    if (!esp_matter_started) {
+        return;
+    }
+    if (!nvs_flush_timer) {
+        esp_timer_create_args_t timer_args = {
+            .callback = nvs_flush_timer_cb,
+            .arg = NULL,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "nvs_flush",
+            .skip_unhandled_events = true,
+        };
+        if (esp_timer_create(&timer_args, &nvs_flush_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Could not create the nvs flush timer");
+            return;
+        }
+    }
+    /* The timer is not restarted on every change, so that the loss window is bounded by the delay */
+    if (!esp_timer_is_active(nvs_flush_timer)) {
+        esp_timer_start_once(nvs_flush_timer, CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_DELAY_MS * 1000ULL);
+    }
+}
+
+static void nvs_flush_shutdown_handler()
+{
+    /* Best effort: the attributes are flushed even if the lock could not be taken in time */
+    lock::status_t lock_status = lock::chip_stack_lock(pdMS_TO_TICKS(100), lock::SITE_NVS);
+    flush_all_nvs();
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+}
+#endif /* CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE */
+
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE || CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+static bool is_dirty()
+{
+    if (!node::node) {
+        return false;
+    }
+    _endpoint_t *endpoint = node::node->endpoint_list;
+    while (endpoint) {
+        if (endpoint->nvs_dirty) {
+            return true;
+        }
+        endpoint = endpoint->next;
+    }
+    return false;
+}
+#endif
+
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+/* The endpoint may still be created, so its snapshot is only stored once it is enabled. The snapshot of an endpoint
+enabled before start is stored by start(), and of one enabled after start by endpoint::enable(). */
+static bool is_snapshot_deferred(_endpoint_t *endpoint)
+{
+    return !esp_matter_started || endpoint->endpoint_index == 0xFFFF;
+}
+#endif
+
+static esp_err_t persist_val(_attribute_t *attribute)
+{
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE
+    _endpoint_t *endpoint = get_endpoint(attribute->endpoint_id);
+    if (endpoint) {
+        attribute->nvs_dirty = true;
+        endpoint->nvs_dirty = true;
+        nvs_flush_timer_start();
+        return ESP_OK;
+    }
+    /* The endpoint is not in the node: store it right away */
+#elif CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    /* The snapshot is stored once in start() or endpoint::enable(), instead of once for every attribute created
+    before that. A snapshot stored earlier would miss the attributes which are not created yet. */
+    _endpoint_t *endpoint = get_endpoint(attribute->endpoint_id);
+    if (endpoint && is_snapshot_deferred(endpoint)) {
+        attribute->nvs_dirty = true;
+        endpoint->nvs_dirty = true;
+        return ESP_OK;
+    }
+#endif
+    return store_val_in_nvs((attribute_t *)attribute);
+}
+
+static void discard_dirty_nvs()
+{
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE
+    if (nvs_flush_timer) {
+        esp_timer_stop(nvs_flush_timer);
+    }
+#endif
+    _endpoint_t *endpoint = node::node ? node::node->endpoint_list : NULL;
+    while (endpoint) {
+        endpoint->nvs_dirty = false;
+        _cluster_t *cluster = endpoint->cluster_list;
+        while (cluster) {
+            _attribute_t *attribute = cluster->attribute_list;
+            while (attribute) {
+                attribute->nvs_dirty = false;
+                attribute = attribute->next;
+            }
+            cluster = cluster->next;
+        }
+        endpoint = endpoint->next;
+    }
+}
+
+/* The default values larger than 2 bytes do not fit in EmberAfDefaultAttributeValue, so they are allocated with
+pool::alloc_value(). The MIN_MAX attributes also allocate an EmberAfAttributeMinMaxValue, with a default, a min and a
+max value. */
+static bool default_value_is_allocated(uint16_t size)
+{
+    return size > 2;
+}
+
+/* Memory allocated for the default value of the attribute by set_default_value_from_current_val(). This returns the
+size and sets the number of allocations in count. */
+static size_t get_default_value_alloc_size(_attribute_t *attribute, uint32_t *count)
+{
+    uint16_t size = attribute->default_value_size;
+    uint32_t value_count = 0;
+    size_t alloc_size = 0;
+    *count = 0;
+    if (attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+        if (!attribute->default_value.ptrToMinMaxValue) {
+            return 0;
+        }
+        alloc_size += sizeof(EmberAfAttributeMinMaxValue);
+        (*count)++;
+        value_count = 3;
+    } else if (attribute->default_value.ptrToDefaultValue) {
+        value_count = 1;
+    }
+    if (default_value_is_allocated(size)) {
+        alloc_size += value_count * pool::get_value_alloc_size(size);
+        *count += value_count;
+    }
+    return alloc_size;
+}
+
+static esp_err_t free_default_value(attribute_t *attribute)
+{
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        return ESP_FAIL;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+
+    /* Free value if data is more than 2 bytes or if it is min max attribute */
+    uint16_t size = current_attribute->default_value_size;
+    if (current_attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+        if (default_value_is_allocated(size)) {
+            pool::free_value((void *)current_attribute->default_value.ptrToMinMaxValue->defaultValue.ptrToDefaultValue,
+                             size);
+            pool::free_value((void *)current_attribute->default_value.ptrToMinMaxValue->minValue.ptrToDefaultValue,
+                             size);
+            pool::free_value((void *)current_attribute->default_value.ptrToMinMaxValue->maxValue.ptrToDefaultValue,
+                             size);
+        }
+        pool::free_object(pool::TYPE_MIN_MAX, (void *)current_attribute->default_value.ptrToMinMaxValue);
+    } else if (default_value_is_allocated(size)) {
+        pool::free_value((void *)current_attribute->default_value.ptrToDefaultValue, size);
+    }
+    return ESP_OK;
+}
+
+static EmberAfDefaultAttributeValue get_default_value_from_data(esp_matter_attr_val_t *val,
+                                                                EmberAfAttributeType attribute_type,
+                                                                uint16_t attribute_size)
+{
+    EmberAfDefaultAttributeValue default_value = (uint16_t)0;
+    if (default_value_is_allocated(attribute_size)) {
+        uint8_t *value = (uint8_t *)pool::alloc_value(attribute_size);
+        if (!value) {
+            ESP_LOGE(TAG, "Could not allocate value buffer for default value");
+            return default_value;
+        }
+        get_data_from_attr_val(val, &attribute_type, &attribute_size, value);
+        /* Directly set the pointer */
+        default_value = value;
+    } else {
+        /* This data is 2 bytes or less. This should be represented as uint16. Copy the bytes appropriately
+        for 0 or 1 or 2 bytes to be converted to uint16. */
+        uint8_t value[2] = {0};
+        get_data_from_attr_val(val, &attribute_type, &attribute_size, value);
+        uint16_t int_value = 0;
+        if (attribute_size == 2) {
+            memcpy(&int_value, value, attribute_size);
+        } else if (attribute_size == 1) {
+            int_value = (uint16_t)*value;
+        }
+        default_value = int_value;
+    }
+    return default_value;
+}
+
+static esp_err_t set_default_value_from_current_val(attribute_t *attribute)
+{
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        return ESP_FAIL;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+    esp_matter_attr_val_t *val = &current_attribute->val;
+
+    /* Get size */
+    EmberAfAttributeType attribute_type = 0;
+    uint16_t attribute_size = 0;
+    get_data_from_attr_val(val, &attribute_type, &attribute_size, NULL);
+
+    /* Get and set value */
+    if (current_attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+        EmberAfAttributeMinMaxValue *temp_value = (EmberAfAttributeMinMaxValue *)pool::alloc_object(
+                                                                                pool::TYPE_MIN_MAX);
+        if (!temp_value) {
+            ESP_LOGE(TAG, "Could not allocate ptrToMinMaxValue for default value");
+            return ESP_FAIL;
+        }
+        temp_value->defaultValue = get_default_value_from_data(val, attribute_type, attribute_size);
+        temp_value->minValue = get_default_value_from_data(&current_attribute->bounds->min, attribute_type,
+                                                           attribute_size);
+        temp_value->maxValue = get_default_value_from_data(&current_attribute->bounds->max, attribute_type,
+                                                           attribute_size);
+        current_attribute->default_value.ptrToMinMaxValue = temp_value;
+    } else if (default_value_is_allocated(attribute_size)) {
+        EmberAfDefaultAttributeValue temp_value = get_default_value_from_data(val, attribute_type, attribute_size);
+        current_attribute->default_value.ptrToDefaultValue = temp_value.ptrToDefaultValue;
+    } else {
+        EmberAfDefaultAttributeValue temp_value = get_default_value_from_data(val, attribute_type, attribute_size);
+        current_attribute->default_value.defaultValue = temp_value.defaultValue;
+    }
+    current_attribute->default_value_size = attribute_size;
+    return ESP_OK;
+}
+} /* attribute */
+
+namespace cluster {
+
+/* Shared cluster metadata
+ *
+ * The attribute metadata and the command lists of a cluster only depend on its attributes and commands, so the
+ * clusters with the same shape (for example the on_off clusters of identical bridged lights) share one read-only,
+ * reference counted copy. The default values are copied into the shape, so that it does not point into the attributes
+ * of any endpoint. Shapes are acquired in endpoint::enable() and released in endpoint::disable(), with the chip stack
+ * lock held.
+ *
+ * A shape is a single allocation: the _shape_t, followed by EmberAfAttributeMetadata[attribute_count],
+ * EmberAfAttributeMinMaxValue[], the accepted and generated CommandId lists, the default value sizes (uint16_t
+ * [attribute_count]) and the default values larger than 2 bytes.
+ */
+typedef struct _shape {
+    uint32_t hash;
+    uint32_t cluster_id;
+    uint16_t ref_count;
+    uint16_t attribute_count;
+    uint16_t cluster_size;
+    size_t size;
+    const EmberAfAttributeMetadata *attributes;
+    const CommandId *accepted_command_list;
+    const CommandId *generated_command_list;
+    const uint16_t *default_value_sizes;
+    struct _shape *next;
+} _shape_t;
+
+static _shape_t *shape_list = NULL;
+
+static uint32_t get_shape_hash(_cluster_t *cluster)
+{
+    /* FNV-1a over the IDs and flags. This is only used for rejecting most of the shapes quickly. */
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ cluster->cluster_id) * 16777619u;
+    _attribute_t *attribute = cluster->attribute_list;
+    while (attribute) {
+        hash = (hash ^ attribute->attribute_id) * 16777619u;
+        hash = (hash ^ attribute->flags) * 16777619u;
+        attribute = attribute->next;
+    }
+    _command_t *command = cluster->command_list;
+    while (command) {
+        hash = (hash ^ command->command_id) * 16777619u;
+        hash = (hash ^ command->flags) * 16777619u;
+        command = command->next;
+    }
+    return hash;
+}
+
+static bool default_value_matches(const EmberAfDefaultAttributeValue &a, const EmberAfDefaultAttributeValue &b,
+                                  uint16_t size)
+{
+    if (size <= 2) {
+        return a.defaultValue == b.defaultValue;
+    }
+    if (!a.ptrToDefaultValue || !b.ptrToDefaultValue) {
+        return a.ptrToDefaultValue == b.ptrToDefaultValue;
+    }
+    return memcmp(a.ptrToDefaultValue, b.ptrToDefaultValue, size) == 0;
+}
+
+static EmberAfDefaultAttributeValue copy_default_value(const EmberAfDefaultAttributeValue &value, uint16_t size,
+                                                       uint8_t **buffer)
+{
+    if (size <= 2) {
+        return EmberAfDefaultAttributeValue(value.defaultValue);
+    }
+    if (!value.ptrToDefaultValue) {
+        return EmberAfDefaultAttributeValue((const uint8_t *)NULL);
+    }
+    const uint8_t *copy = *buffer;
+    memcpy(*buffer, value.ptrToDefaultValue, size);
+    *buffer += size;
+    return EmberAfDefaultAttributeValue(copy);
+}
+
+static bool command_list_matches(const CommandId *command_ids, _command_t *command, int command_flag)
+{
+    while (command) {
+        if (command->flags & command_flag) {
+            if (!command_ids || *command_ids != command->command_id) {
+                return false;
+            }
+            command_ids++;
+        }
+        command = command->next;
+    }
+    return !command_ids || *command_ids == kInvalidCommandId;
+}
+
+static bool shape_matches(_shape_t *shape, _cluster_t *cluster, uint32_t hash)
+{
+    if (shape->hash != hash || shape->cluster_id != cluster->cluster_id) {
+        return false;
+    }
+    uint16_t index = 0;
+    _attribute_t *attribute = cluster->attribute_list;
+    while (attribute) {
+        if (index >= shape->attribute_count) {
+            return false;
+        }
+        const EmberAfAttributeMetadata *metadata = &shape->attributes[index];
+        EmberAfAttributeType attribute_type = 0;
+        uint16_t attribute_size = 0;
+        attribute::get_data_from_attr_val(&attribute->val, &attribute_type, &attribute_size, NULL);
+        if (metadata->attributeId != attribute->attribute_id || metadata->mask != (EmberAfAttributeMask)attribute->flags
+            || metadata->attributeType != attribute_type || metadata->size != attribute_size) {
+            return false;
+        }
+        uint16_t default_value_size = attribute->default_value_size;
+        if (shape->default_value_sizes[index] != default_value_size) {
+            return false;
+        }
+        if (attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+            const EmberAfAttributeMinMaxValue *a = metadata->defaultValue.ptrToMinMaxValue;
+            const EmberAfAttributeMinMaxValue *b = attribute->default_value.ptrToMinMaxValue;
+            if (!a || !b) {
+                if (a != b) {
+                    return false;
+                }
+            } else if (!default_value_matches(a->defaultValue, b->defaultValue, default_value_size) ||
+                !default_value_matches(a->minValue, b->minValue, default_value_size) ||
+                !default_value_matches(a->maxValue, b->maxValue, default_value_size)) {
+                return false;
+            }
+        } else if (default_value_size > 2) {
+            if (!default_value_matches(EmberAfDefaultAttributeValue(metadata->defaultValue.ptrToDefaultValue),
+                                       EmberAfDefaultAttributeValue(attribute->default_value.ptrToDefaultValue),
+                                       default_value_size)) {
+                return false;
+            }
+        } else if (metadata->defaultValue.defaultValue != attribute->default_value.defaultValue) {
+            return false;
+        }
+        index++;
+        attribute = attribute->next;
+    }
+    if (index != shape->attribute_count) {
+        return false;
+    }
+    return command_list_matches(shape->accepted_command_list, cluster->command_list, COMMAND_FLAG_ACCEPTED) &&
+           command_list_matches(shape->generated_command_list, cluster->command_list, COMMAND_FLAG_GENERATED);
+}
+
+static _shape_t *create_shape(_cluster_t *cluster, uint32_t hash)
+{
+    /* Get size */
+    int attribute_count = 0;
+    int min_max_count = 0;
+    size_t default_values_size = 0;
+    _attribute_t *attribute = cluster->attribute_list;
+    while (attribute) {
+        int value_count = 1;
+        if (attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+            min_max_count++;
+            value_count = 3;
+        }
+        if (attribute->default_value_size > 2) {
+            default_values_size += value_count * attribute->default_value_size;
+        }
+        attribute_count++;
+        attribute = attribute->next;
+    }
+    int accepted_count = 0;
+    int generated_count = 0;
+    _command_t *command = cluster->command_list;
+    while (command) {
+        if (command->flags & COMMAND_FLAG_ACCEPTED) {
+            accepted_count++;
+        }
+        if (command->flags & COMMAND_FLAG_GENERATED) {
+            generated_count++;
+        }
+        command = command->next;
+    }
+    int command_id_count = (accepted_count > 0 ? accepted_count + 1 : 0) +
+                           (generated_count > 0 ? generated_count + 1 : 0);
+    size_t size = sizeof(_shape_t) + attribute_count * sizeof(EmberAfAttributeMetadata) +
+                  min_max_count * sizeof(EmberAfAttributeMinMaxValue) + command_id_count * sizeof(CommandId) +
+                  attribute_count * sizeof(uint16_t) + default_values_size;
+
+    /* Allocate */
+    uint8_t *block = (uint8_t *)calloc(1, size);
+    if (!block) {
+        ESP_LOGE(TAG, "Couldn't allocate the cluster metadata");
+        return NULL;
+    }
+    _shape_t *shape = (_shape_t *)block;
+    EmberAfAttributeMetadata *matter_attributes = (EmberAfAttributeMetadata *)(shape + 1);
+    EmberAfAttributeMinMaxValue *min_max_values = (EmberAfAttributeMinMaxValue *)(matter_attributes +
+                                                                                  attribute_count);
+    CommandId *command_ids = (CommandId *)(min_max_values + min_max_count);
+    uint16_t *default_value_sizes = (uint16_t *)(command_ids + command_id_count);
+    uint8_t *default_values = (uint8_t *)(default_value_sizes + attribute_count);
+
+    /* Attributes */
+    int index = 0;
+    attribute = cluster->attribute_list;
+    while (attribute) {
+        EmberAfAttributeMetadata *metadata = &matter_attributes[index];
+        uint16_t default_value_size = attribute->default_value_size;
+        metadata->attributeId = attribute->attribute_id;
+        metadata->mask = attribute->flags;
+        if ((attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) && attribute->default_value.ptrToMinMaxValue) {
+            const EmberAfAttributeMinMaxValue *value = attribute->default_value.ptrToMinMaxValue;
+            min_max_values->defaultValue = copy_default_value(value->defaultValue, default_value_size,
+                                                              &default_values);
+            min_max_values->minValue = copy_default_value(value->minValue, default_value_size, &default_values);
+            min_max_values->maxValue = copy_default_value(value->maxValue, default_value_size, &default_values);
+            metadata->defaultValue = (const EmberAfAttributeMinMaxValue *)min_max_values;
+            min_max_values++;
+        } else if (attribute->flags & ATTRIBUTE_FLAG_MIN_MAX) {
+            metadata->defaultValue = (const EmberAfAttributeMinMaxValue *)NULL;
+        } else if (default_value_size > 2) {
+            EmberAfDefaultAttributeValue value(attribute->default_value.ptrToDefaultValue);
+            metadata->defaultValue = copy_default_value(value, default_value_size, &default_values).ptrToDefaultValue;
+        } else {
+            metadata->defaultValue = attribute->default_value.defaultValue;
+        }
+        attribute::get_data_from_attr_val(&attribute->val, &metadata->attributeType, &metadata->size, NULL);
+        default_value_sizes[index] = default_value_size;
+        shape->cluster_size += metadata->size;
+        index++;
+        attribute = attribute->next;
+    }
+
+    /* Commands */
+    shape->accepted_command_list = command::fill_ids(cluster->command_list, COMMAND_FLAG_ACCEPTED, &command_ids);
+    shape->generated_command_list = command::fill_ids(cluster->command_list, COMMAND_FLAG_GENERATED, &command_ids);
+
+    shape->hash = hash;
+    shape->cluster_id = cluster->cluster_id;
+    shape->attribute_count = attribute_count;
+    shape->attributes = matter_attributes;
+    shape->default_value_sizes = default_value_sizes;
+    shape->size = size;
+    return shape;
+}
+
+static _shape_t *acquire_shape(_cluster_t *cluster)
+{
+    uint32_t hash = get_shape_hash(cluster);
+    _shape_t *shape = shape_list;
+    while (shape) {
+        if (shape_matches(shape, cluster, hash)) {
+            shape->ref_count++;
+            return shape;
+        }
+        shape = shape->next;
+    }
+    shape = create_shape(cluster, hash);
+    if (!shape) {
+        return NULL;
+    }
+    shape->ref_count = 1;
+    shape->next = shape_list;
+    shape_list = shape;
+    return shape;
+}
+
+static void release_shape(_shape_t *shape)
+{
+    if (!shape || --shape->ref_count > 0) {
+        return;
+    }
+    _shape_t *previous_shape = NULL;
+    _shape_t *current_shape = shape_list;
+    while (current_shape && current_shape != shape) {
+        previous_shape = current_shape;
+        current_shape = current_shape->next;
+    }
+    if (current_shape) {
+        if (previous_shape == NULL) {
+            shape_list = current_shape->next;
+        } else {
+            previous_shape->next = current_shape->next;
+        }
+    }
+    free(shape);
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static void print_shape_stats()
+{
+    int count = 0;
+    int ref_count = 0;
+    size_t size = 0;
+    size_t saved_size = 0;
+    _shape_t *shape = shape_list;
+    while (shape) {
+        count++;
+        ref_count += shape->ref_count;
+        size += shape->size;
+        saved_size += (shape->ref_count - 1) * (shape->size - sizeof(_shape_t));
+        shape = shape->next;
+    }
+    printf("Shared cluster metadata: %d shapes used by %d clusters, %d bytes, %d bytes saved\n", count, ref_count,
+           (int)size, (int)saved_size);
+}
+#endif /* CONFIG_ENABLE_CHIP_SHELL */
+
+} /* cluster */
+
+namespace endpoint {
+
+#define DYNAMIC_ENDPOINT_COUNT (MAX_ENDPOINT_COUNT - FIXED_ENDPOINT_COUNT)
+
+/* Bitmap of the used dynamic endpoint indices. The index of an enabled endpoint is stored in the endpoint, so that
+enable() and disable() do not have to search the endpoint table. This is protected by the chip stack lock. */
+static uint32_t used_index_bitmap[(DYNAMIC_ENDPOINT_COUNT + 31) / 32];
+
+/* Enabled endpoints, by endpoint ID
+ *
+ * Open addressing hash table (linear probing) with at least twice as many slots as dynamic endpoints, so that the
+ * commands can be dispatched without searching the endpoints. This is protected by the chip stack lock.
+ */
+static constexpr uint32_t next_power_of_two(uint32_t count)
+{
+    return count <= 1 ? 1 : 2 * next_power_of_two((count + 1) / 2);
+}
+#define ENABLED_ENDPOINT_SLOT_COUNT next_power_of_two(2 * DYNAMIC_ENDPOINT_COUNT)
+static _endpoint_t *enabled_endpoints[ENABLED_ENDPOINT_SLOT_COUNT];
+
+static uint32_t enabled_endpoint_slot(uint16_t endpoint_id)
+{
+    return ((endpoint_id * 0x9E3779B1) >> 16) & (ENABLED_ENDPOINT_SLOT_COUNT - 1);
+}
+
+static void enabled_endpoint_add(_endpoint_t *endpoint)
+{
+    /* The table cannot be full, since there are fewer endpoints than slots */
+    uint32_t slot = enabled_endpoint_slot(endpoint->endpoint_id);
+    while (enabled_endpoints[slot]) {
+        slot = (slot + 1) & (ENABLED_ENDPOINT_SLOT_COUNT - 1);
+    }
+    enabled_endpoints[slot] = endpoint;
+}
+
+static void enabled_endpoint_remove(_endpoint_t *endpoint)
+{
+    uint32_t mask = ENABLED_ENDPOINT_SLOT_COUNT - 1;
+    uint32_t slot = enabled_endpoint_slot(endpoint->endpoint_id);
+    while (enabled_endpoints[slot] != endpoint) {
+        if (!enabled_endpoints[slot]) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /* Backward shift deletion, as for the attribute index */
+    uint32_t next = slot;
+    while (true) {
+        enabled_endpoints[slot] = NULL;
+        while (true) {
+            next = (next + 1) & mask;
+            if (!enabled_endpoints[next]) {
+                return;
+            }
+            uint32_t home = enabled_endpoint_slot(enabled_endpoints[next]->endpoint_id);
+            bool stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+            if (!stays) {
+                break;
+            }
+        }
+        enabled_endpoints[slot] = enabled_endpoints[next];
+        slot = next;
+    }
+}
+
+static _endpoint_t *enabled_endpoint_find(uint16_t endpoint_id)
+{
+    uint32_t slot = enabled_endpoint_slot(endpoint_id);
+    while (enabled_endpoints[slot]) {
+        if (enabled_endpoints[slot]->endpoint_id == endpoint_id) {
+            return enabled_endpoints[slot];
+        }
+        slot = (slot + 1) & (ENABLED_ENDPOINT_SLOT_COUNT - 1);
+    }
+    return NULL;
+}
+
+static uint16_t allocate_index()
+{
+    for (int word = 0; word < (DYNAMIC_ENDPOINT_COUNT + 31) / 32; word++) {
+        uint32_t free_bits = ~used_index_bitmap[word];
+        if (free_bits) {
+            int index = word * 32 + __builtin_ctz(free_bits);
+            if (index >= DYNAMIC_ENDPOINT_COUNT) {
+                break;
+            }
+            used_index_bitmap[word] |= 1u << (index % 32);
+            return index;
+        }
+    }
+    return 0xFFFF;
+}
+
+static void free_index(uint16_t index)
+{
+    if (index < DYNAMIC_ENDPOINT_COUNT) {
+        used_index_bitmap[index / 32] &= ~(1u << (index % 32));
+    }
+}
+
+static esp_err_t disable(endpoint_t *endpoint)
+{
+    if (!endpoint) {
+        ESP_LOGE(TAG, "Endpoint cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ENDPOINT_DISABLE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+
+    /* Remove endpoint */
+    _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
+    uint16_t endpoint_index = current_endpoint->endpoint_index;
+    if (endpoint_index == 0xFFFF) {
+        ESP_LOGE(TAG, "Could not find endpoint index");
+        if (lock_status == lock::SUCCESS) {
+            lock::chip_stack_unlock();
+        }
+        return ESP_FAIL;
+    }
+    emberAfClearDynamicEndpoint(endpoint_index);
+    free_index(endpoint_index);
+    enabled_endpoint_remove(current_endpoint);
+    current_endpoint->endpoint_index = 0xFFFF;
+    _command_entry_t *command_table = current_endpoint->command_table;
+    current_endpoint->command_table = NULL;
+    current_endpoint->command_count = 0;
+    attribute::index_remove_endpoint(current_endpoint);
+    /* The resolved attribute handles hold the Ember metadata of the endpoint, which is freed below */
+    attribute::invalidate_caches();
+
+    if (!(current_endpoint->endpoint_type)) {
+        ESP_LOGE(TAG, "endpoint %d's endpoint_type is NULL", current_endpoint->endpoint_id);
+        if (lock_status == lock::SUCCESS) {
+            lock::chip_stack_unlock();
+        }
+        free(command_table);
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Release the shared cluster metadata */
+    void *block = (void *)current_endpoint->device_types_ptr;
+    if (!current_endpoint->static_endpoint_type) {
+        const EmberAfEndpointType *endpoint_type = current_endpoint->endpoint_type;
+        cluster::_shape_t **shapes = (cluster::_shape_t **)(endpoint_type->cluster + endpoint_type->clusterCount);
+        for (int i = 0; i < endpoint_type->clusterCount; i++) {
+            cluster::release_shape(shapes[i]);
+        }
+        block = (void *)endpoint_type;
+    }
+
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    /* Free the metadata. This is a single block, see enable(). */
+    free(block);
+    free(command_table);
+    current_endpoint->endpoint_type = NULL;
+    current_endpoint->data_versions_ptr = NULL;
+    current_endpoint->device_types_ptr = NULL;
+    return ESP_OK;
+}
+
+/* Layout of the metadata of an endpoint, which is allocated as a single block in this order (by decreasing
+ * alignment): EmberAfEndpointType, EmberAfCluster[cluster_count], cluster::_shape_t *[cluster_count],
+ * EmberAfDeviceType[device_type_count], DataVersion[cluster_count]. The attribute metadata and the command lists
+ * are in the shared cluster shapes. With static metadata, only the device types and the data versions are
+ * allocated.
+ */
+static size_t get_layout_size(_endpoint_t *endpoint, int cluster_count)
+{
+    size_t size = endpoint->device_type_count * sizeof(EmberAfDeviceType) + cluster_count * sizeof(DataVersion);
+    if (!endpoint->static_endpoint_type) {
+        size += sizeof(EmberAfEndpointType) + cluster_count * (sizeof(EmberAfCluster) + sizeof(cluster::_shape_t *));
+    }
+    return size;
+}
+
+/* The static metadata must describe the clusters and the attributes of the endpoint in the same order, since the
+attributes are accessed through the external storage callbacks. */
+static bool check_static_metadata(_endpoint_t *endpoint, const EmberAfEndpointType *endpoint_type)
+{
+    _cluster_t *cluster = endpoint->cluster_list;
+    for (int i = 0; i < endpoint_type->clusterCount; i++) {
+        const EmberAfCluster *matter_cluster = &endpoint_type->cluster[i];
+        if (!cluster || cluster->cluster_id != matter_cluster->clusterId) {
+            ESP_LOGE(TAG, "Static metadata of endpoint %d: cluster 0x%04x does not match", endpoint->endpoint_id,
+                     matter_cluster->clusterId);
+            return false;
+        }
+        /* The functions are called for the function flags of the mask */
+        bool has_functions = matter_cluster->mask & ~(CLUSTER_FLAG_SERVER | CLUSTER_FLAG_CLIENT);
+        if (matter_cluster->mask != (EmberAfClusterMask)cluster->flags ||
+            (has_functions && !matter_cluster->functions)) {
+            ESP_LOGE(TAG, "Static metadata of endpoint %d: mask of cluster 0x%04x does not match",
+                     endpoint->endpoint_id, matter_cluster->clusterId);
+            return false;
+        }
+        if (!command::ids_match(cluster->command_list, COMMAND_FLAG_ACCEPTED, matter_cluster->acceptedCommandList) ||
+            !command::ids_match(cluster->command_list, COMMAND_FLAG_GENERATED,
+                                matter_cluster->generatedCommandList)) {
+            ESP_LOGE(TAG, "Static metadata of endpoint %d: commands of cluster 0x%04x do not match",
+                     endpoint->endpoint_id, matter_cluster->clusterId);
+            return false;
+        }
+        _attribute_t *attribute = cluster->attribute_list;
+        for (int j = 0; j < matter_cluster->attributeCount; j++) {
+            const EmberAfAttributeMetadata *metadata = &matter_cluster->attributes[j];
+            EmberAfAttributeType attribute_type = 0;
+            uint16_t attribute_size = 0;
+            if (attribute) {
+                attribute::get_data_from_attr_val(&attribute->val, &attribute_type, &attribute_size, NULL);
+            }
+            /* The strings need at least the space of the current value. The other types have a fixed size. */
+            bool size_matches = attribute && (attribute::is_string_type(attribute->val.type) ?
+                                              metadata->size >= attribute_size : metadata->size == attribute_size);
+            /* The mask is the same as the generated one, which also has ATTRIBUTE_FLAG_EXTERNAL_STORAGE */
+            if (!attribute || attribute->attribute_id != metadata->attributeId ||
+                attribute_type != metadata->attributeType || !size_matches ||
+                metadata->mask != (EmberAfAttributeMask)attribute->flags) {
+                ESP_LOGE(TAG, "Static metadata of endpoint %d: attribute 0x%04x on cluster 0x%04x does not match",
+                         endpoint->endpoint_id, metadata->attributeId, matter_cluster->clusterId);
+                return false;
+            }
+            attribute = attribute->next;
+        }
+        if (attribute) {
+            ESP_LOGE(TAG, "Static metadata of endpoint %d: attribute 0x%04x on cluster 0x%04x is missing",
+                     endpoint->endpoint_id, attribute->attribute_id, cluster->cluster_id);
+            return false;
+        }
+        cluster = cluster->next;
+    }
+    if (cluster) {
+        ESP_LOGE(TAG, "Static metadata of endpoint %d: cluster 0x%04x is missing", endpoint->endpoint_id,
+                 cluster->cluster_id);
+        return false;
+    }
+    return true;
+}
+
+esp_err_t set_static_metadata(endpoint_t *endpoint, const EmberAfEndpointType *endpoint_type)
+{
+    if (!endpoint) {
+        ESP_LOGE(TAG, "Endpoint cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
+    if (current_endpoint->endpoint_type) {
+        ESP_LOGE(TAG, "Cannot set the static metadata of endpoint %d after it has been enabled",
+                 current_endpoint->endpoint_id);
+        return ESP_ERR_INVALID_STATE;
+    }
+    current_endpoint->static_endpoint_type = endpoint_type;
+    return ESP_OK;
+}
+
+/* State of an endpoint between prepare() and install() */
+typedef struct _enable_context {
+    uint8_t *block;
+    _command_entry_t *command_table;
+    uint16_t command_count;
+    int cluster_count;
+} _enable_context_t;
+
+/* Build the parts of the metadata of the endpoint which do not need the chip stack lock */
+static esp_err_t prepare(_endpoint_t *current_endpoint, _enable_context_t *context)
+{
+    int cluster_count = 0;
+    _cluster_t *cluster = current_endpoint->cluster_list;
+    const EmberAfEndpointType *static_endpoint_type = current_endpoint->static_endpoint_type;
+    if (static_endpoint_type) {
+        if (!check_static_metadata(current_endpoint, static_endpoint_type)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        cluster_count = static_endpoint_type->clusterCount;
+    } else {
+        while (cluster) {
+            cluster_count++;
+            cluster = cluster->next;
+        }
+    }
+
+    /* Command table for the dispatch, which is only visible once the endpoint is added */
+    _command_entry_t *command_table = NULL;
+    uint16_t command_count = 0;
+    if (command::build_table(current_endpoint, &command_table, &command_count) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Allocate the metadata in a single block, which is freed in disable(). The block of a static endpoint without
+    device types and clusters is empty, but it is still allocated, since calloc() may return NULL for 0 bytes and a
+    NULL block means that the endpoint is not prepared. */
+    size_t layout_size = get_layout_size(current_endpoint, cluster_count);
+    uint8_t *block = (uint8_t *)calloc(1, layout_size > 0 ? layout_size : 1);
+    if (!block) {
+        ESP_LOGE(TAG, "Couldn't allocate the endpoint metadata");
+        free(command_table);
+        return ESP_ERR_NO_MEM;
+    }
+    EmberAfEndpointType *endpoint_type = NULL;
+    EmberAfDeviceType *device_types_ptr = (EmberAfDeviceType *)block;
+    if (!static_endpoint_type) {
+        endpoint_type = (EmberAfEndpointType *)block;
+        EmberAfCluster *matter_clusters = (EmberAfCluster *)(endpoint_type + 1);
+        cluster::_shape_t **shapes = (cluster::_shape_t **)(matter_clusters + cluster_count);
+        device_types_ptr = (EmberAfDeviceType *)(shapes + cluster_count);
+        endpoint_type->cluster = matter_clusters;
+        endpoint_type->clusterCount = cluster_count;
+    }
+    DataVersion *data_versions_ptr = (DataVersion *)(device_types_ptr + current_endpoint->device_type_count);
+
+    /* Device types */
+    for (size_t i = 0; i < current_endpoint->device_type_count; ++i) {
+        device_types_ptr[i].deviceId = current_endpoint->device_type_ids[i];
+        device_types_ptr[i].deviceVersion = current_endpoint->device_type_versions[i];
+    }
+
+    current_endpoint->endpoint_type = static_endpoint_type ? static_endpoint_type : endpoint_type;
+    current_endpoint->data_versions_ptr = data_versions_ptr;
+    current_endpoint->device_types_ptr = device_types_ptr;
+    context->block = block;
+    context->command_table = command_table;
+    context->command_count = command_count;
+    context->cluster_count = cluster_count;
+    return ESP_OK;
+}
+
+/* Free what prepare() has allocated, if the endpoint could not be installed */
+static void discard(_endpoint_t *current_endpoint, _enable_context_t *context)
+{
+    free(context->command_table);
+    free(context->block);
+    memset(context, 0, sizeof(_enable_context_t));
+    current_endpoint->endpoint_type = NULL;
+    current_endpoint->data_versions_ptr = NULL;
+    current_endpoint->device_types_ptr = NULL;
+}
+
+/* Fill the clusters and add the endpoint to the data model. This must be called with the chip stack lock held, which
+also protects the shared cluster metadata. */
+static esp_err_t install(_endpoint_t *current_endpoint, _enable_context_t *context, uint16_t parent_endpoint_id)
+{
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    /* The attributes of the endpoint have been created, so the snapshot is not needed anymore. A new or migrated
+    snapshot of an endpoint enabled after start is stored now. This is done with the lock held, since the nvs flush
+    on the chip thread walks the same endpoint. */
+    attribute::free_snapshot(current_endpoint);
+    if (esp_matter_started) {
+        attribute::flush_endpoint_nvs(current_endpoint);
+    }
+#endif
+    int cluster_count = context->cluster_count;
+    cluster::_shape_t **shapes = NULL;
+    chip::Span<EmberAfDeviceType> device_types(current_endpoint->device_types_ptr,
+                                               current_endpoint->device_type_count);
+    chip::Span<chip::DataVersion> data_versions(current_endpoint->data_versions_ptr, cluster_count);
+    esp_err_t err = ESP_OK;
+    uint16_t endpoint_index = 0xFFFF;
+    EmberAfStatus status;
+
+    /* Fill the clusters */
+    if (!current_endpoint->static_endpoint_type) {
+        EmberAfEndpointType *endpoint_type = (EmberAfEndpointType *)context->block;
+        EmberAfCluster *matter_clusters = (EmberAfCluster *)(endpoint_type + 1);
+        shapes = (cluster::_shape_t **)(matter_clusters + cluster_count);
+        int cluster_index = 0;
+        _cluster_t *cluster = current_endpoint->cluster_list;
+        while (cluster) {
+            EmberAfCluster *matter_cluster = &matter_clusters[cluster_index];
+            cluster::_shape_t *shape = cluster::acquire_shape(cluster);
+            if (!shape) {
+                err = ESP_ERR_NO_MEM;
+                goto release;
+            }
+            shapes[cluster_index] = shape;
+
+            matter_cluster->attributes = shape->attributes;
+            matter_cluster->attributeCount = shape->attribute_count;
+            matter_cluster->clusterSize = shape->cluster_size;
+            matter_cluster->acceptedCommandList = shape->accepted_command_list;
+            matter_cluster->generatedCommandList = shape->generated_command_list;
+            matter_cluster->clusterId = cluster->cluster_id;
+            matter_cluster->mask = cluster->flags;
+            matter_cluster->functions = (EmberAfGenericClusterFunction *)cluster->function_list;
+
+            /* Get next cluster */
+            endpoint_type->endpointSize += matter_cluster->clusterSize;
+            cluster = cluster->next;
+            cluster_index++;
+        }
+    }
+
+    /* Index the attributes before the endpoint is visible, so that the external callbacks can resolve them */
+    err = attribute::index_add_endpoint(current_endpoint);
+    if (err != ESP_OK) {
+        attribute::index_remove_endpoint(current_endpoint);
+        goto release;
+    }
+
+    /* Add Endpoint */
+    endpoint_index = allocate_index();
+    if (endpoint_index == 0xFFFF) {
+        ESP_LOGE(TAG, "No free dynamic endpoint index for endpoint %d", current_endpoint->endpoint_id);
+        err = ESP_ERR_NO_MEM;
+        attribute::index_remove_endpoint(current_endpoint);
+        goto release;
+    }
+    status = emberAfSetDynamicEndpoint(endpoint_index, current_endpoint->endpoint_id, current_endpoint->endpoint_type,
+                                       data_versions, device_types, parent_endpoint_id);
+    if (status != EMBER_ZCL_STATUS_SUCCESS) {
+        ESP_LOGE(TAG, "Error adding dynamic endpoint %d: 0x%x", current_endpoint->endpoint_id, status);
+        err = ESP_FAIL;
+        free_index(endpoint_index);
+        attribute::index_remove_endpoint(current_endpoint);
+        goto release;
+    }
+    current_endpoint->endpoint_index = endpoint_index;
+    current_endpoint->command_table = context->command_table;
+    current_endpoint->command_count = context->command_count;
+    enabled_endpoint_add(current_endpoint);
+    /* The caches of the attributes of the endpoint have been resolved while it was not enabled */
+    attribute::invalidate_caches();
+    return ESP_OK;
+
+release:
+    for (int i = 0; shapes && i < cluster_count; i++) {
+        cluster::release_shape(shapes[i]);
+    }
+    return err;
+}
 
-        /* This is to avoid double free in case of errors */
-        matter_attributes = NULL;
-        accepted_command_ids = NULL;
-        generated_command_ids = NULL;
+esp_err_t enable(endpoint_t *endpoint, uint16_t parent_endpoint_id)
+{
+    if (!endpoint) {
+        ESP_LOGE(TAG, "Endpoint cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
+    _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
+    _enable_context_t context;
+    memset(&context, 0, sizeof(_enable_context_t));
+    esp_err_t err = prepare(current_endpoint, &context);
     if (err != ESP_OK) {
-        goto cleanup;
+        return err;
     }
 
-    endpoint_type->cluster = matter_clusters;
-    endpoint_type->clusterCount = cluster_count;
-
     /* Take lock if not already taken */
-    lock_status = lock::chip_stack_lock(portMAX_DELAY);
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ENDPOINT_ENABLE);
     if (lock_status == lock::FAILED) {
         ESP_LOGE(TAG, "Could not get task context");
-        goto cleanup;
-    }
-
-    /* Add Endpoint */
-    endpoint_index = endpoint::get_next_index();
-    status = emberAfSetDynamicEndpoint(endpoint_index, current_endpoint->endpoint_id, endpoint_type, data_versions,
-                                       device_types, parent_endpoint_id);
-    if (status != EMBER_ZCL_STATUS_SUCCESS) {
-        ESP_LOGE(TAG, "Error adding dynamic endpoint %d: 0x%x", current_endpoint->endpoint_id, status);
-        err = ESP_FAIL;
-        if (lock_status == lock::SUCCESS) {
-            lock::chip_stack_unlock();
-        }
-        goto cleanup;
+        discard(current_endpoint, &context);
+        return ESP_FAIL;
     }
+    err = install(current_endpoint, &context, parent_endpoint_id);
     if (lock_status == lock::SUCCESS) {
         lock::chip_stack_unlock();
     }
+    if (err != ESP_OK) {
+        discard(current_endpoint, &context);
+        return err;
+    }
     ESP_LOGI(TAG, "Dynamic endpoint %d added", current_endpoint->endpoint_id);
-    return err;
+    return ESP_OK;
+}
+
+static uint32_t get_attribute_count(_endpoint_t *endpoint)
+{
+    uint32_t count = 0;
+    _cluster_t *cluster = endpoint->cluster_list;
+    while (cluster) {
+        _attribute_t *attribute = cluster->attribute_list;
+        while (attribute) {
+            count++;
+            attribute = attribute->next;
+        }
+        cluster = cluster->next;
+    }
+    return count;
+}
 
-cleanup:
-    if (generated_command_ids) {
-        free(generated_command_ids);
+esp_err_t enable(endpoint_t **endpoints, const uint16_t *parent_endpoint_ids, size_t count)
+{
+    if (!endpoints) {
+        ESP_LOGE(TAG, "Endpoints cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
     }
-    if (accepted_command_ids) {
-        free(accepted_command_ids);
+    if (count == 0) {
+        return ESP_OK;
     }
-    if (matter_attributes) {
-        free(matter_attributes);
+    _enable_context_t *contexts = (_enable_context_t *)calloc(count, sizeof(_enable_context_t));
+    if (!contexts) {
+        ESP_LOGE(TAG, "Couldn't allocate the enable contexts");
+        return ESP_ERR_NO_MEM;
     }
-    if (matter_clusters) {
-        for (int cluster_index = 0; cluster_index < cluster_count; cluster_index++) {
-            /* Free attributes */
-            if (matter_clusters[cluster_index].attributes) {
-                free((void *)matter_clusters[cluster_index].attributes);
-            }
-            /* Free commands */
-            if (matter_clusters[cluster_index].acceptedCommandList) {
-                free((void *)matter_clusters[cluster_index].acceptedCommandList);
-            }
-            if (matter_clusters[cluster_index].generatedCommandList) {
-                free((void *)matter_clusters[cluster_index].generatedCommandList);
+
+    /* Build all the metadata before taking the lock */
+    esp_err_t err = ESP_OK;
+    uint32_t attribute_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        _endpoint_t *current_endpoint = (_endpoint_t *)endpoints[i];
+        esp_err_t prepare_err = current_endpoint ? prepare(current_endpoint, &contexts[i]) : ESP_ERR_INVALID_ARG;
+        if (prepare_err != ESP_OK) {
+            err = err == ESP_OK ? prepare_err : err;
+            continue;
+        }
+        attribute_count += get_attribute_count(current_endpoint);
+    }
+
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ENDPOINT_ENABLE);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        for (size_t i = 0; i < count; i++) {
+            if (contexts[i].block) {
+                discard((_endpoint_t *)endpoints[i], &contexts[i]);
             }
         }
-        free(matter_clusters);
+        free(contexts);
+        return ESP_FAIL;
     }
-    if (data_versions_ptr) {
-        free(data_versions_ptr);
-        current_endpoint->data_versions_ptr = NULL;
+    /* Size the attribute index once for all the endpoints, instead of growing it while they are added. If this
+    fails, the index still grows in index_add(). */
+    attribute::index_reserve(attribute_count);
+    int added_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!contexts[i].block) {
+            continue;
+        }
+        uint16_t parent_endpoint_id = parent_endpoint_ids ? parent_endpoint_ids[i] : chip::kInvalidEndpointId;
+        esp_err_t install_err = install((_endpoint_t *)endpoints[i], &contexts[i], parent_endpoint_id);
+        if (install_err != ESP_OK) {
+            err = err == ESP_OK ? install_err : err;
+            continue;
+        }
+        /* Installed, the memory now belongs to the endpoint */
+        contexts[i].block = NULL;
+        added_count++;
     }
-    if (device_types_ptr) {
-        free(device_types_ptr);
-        current_endpoint->device_types_ptr = NULL;
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
     }
-    if (endpoint_type) {
-        free(endpoint_type);
-        current_endpoint->endpoint_type = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        if (contexts[i].block) {
+            discard((_endpoint_t *)endpoints[i], &contexts[i]);
+        } else if (endpoints[i] && ((_endpoint_t *)endpoints[i])->endpoint_index != 0xFFFF) {
+            ESP_LOGD(TAG, "Dynamic endpoint %d added", ((_endpoint_t *)endpoints[i])->endpoint_id);
+        }
     }
+    free(contexts);
+    ESP_LOGI(TAG, "%d of %u dynamic endpoints added", added_count, (unsigned)count);
     return err;
 }
 
@@ -687,55 +2315,501 @@ static esp_err_t enable_all()
         return ESP_OK;
     }
 
+    size_t count = 0;
     endpoint_t *endpoint = get_first(node);
     while (endpoint) {
-        /* The normal endpoints do not have parent endpoint */
-        enable(endpoint, chip::kInvalidEndpointId);
+        count++;
         endpoint = get_next(endpoint);
     }
-    return ESP_OK;
+    if (count == 0) {
+        return ESP_OK;
+    }
+    endpoint_t **endpoints = (endpoint_t **)calloc(count, sizeof(endpoint_t *));
+    if (!endpoints) {
+        ESP_LOGE(TAG, "Couldn't allocate the endpoint list");
+        return ESP_ERR_NO_MEM;
+    }
+    endpoint = get_first(node);
+    for (size_t i = 0; i < count; i++) {
+        endpoints[i] = endpoint;
+        endpoint = get_next(endpoint);
+    }
+    /* The normal endpoints do not have parent endpoint */
+    esp_err_t err = enable(endpoints, NULL, count);
+    free(endpoints);
+    return err;
 }
 } /* endpoint */
 
 namespace lock {
-#define DEFAULT_TICKS (500 / portTICK_PERIOD_MS) /* 500 ms in ticks */
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+static stats_t site_stats[SITE_MAX];
+static portMUX_TYPE stats_spinlock = portMUX_INITIALIZER_UNLOCKED;
+/* These are only accessed by the holder of the lock */
+static int64_t locked_at = 0;
+static site_t locked_site = SITE_OTHER;
+
+static void record_time(uint32_t *histogram, uint32_t *max_us, int64_t time_us)
+{
+    int bucket = 0;
+    for (int64_t limit = 100; bucket < ESP_MATTER_LOCK_HISTOGRAM_SIZE - 1 && time_us >= limit; limit *= 10) {
+        bucket++;
+    }
+    histogram[bucket]++;
+    if (time_us > *max_us) {
+        *max_us = time_us;
+    }
+}
+
+static void record_lock(site_t site, int64_t start)
+{
+    locked_at = esp_timer_get_time();
+    locked_site = site;
+    portENTER_CRITICAL(&stats_spinlock);
+    site_stats[site].count++;
+    record_time(site_stats[site].wait_histogram, &site_stats[site].max_wait_us, locked_at - start);
+    portEXIT_CRITICAL(&stats_spinlock);
+}
+#endif /* CONFIG_ESP_MATTER_LOCK_STATS_ENABLE */
+
 status_t chip_stack_lock(uint32_t ticks_to_wait)
+{
+    return chip_stack_lock(ticks_to_wait, SITE_OTHER);
+}
+
+status_t chip_stack_lock(uint32_t ticks_to_wait, site_t site)
 {
 #if CHIP_STACK_LOCK_TRACKING_ENABLED
     if (PlatformMgr().IsChipStackLockedByCurrentThread()) {
         return ALREADY_TAKEN;
     }
+#endif
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    int64_t start = esp_timer_get_time();
+    if (site >= SITE_MAX) {
+        site = SITE_OTHER;
+    }
 #endif
     if (ticks_to_wait == portMAX_DELAY) {
         /* Special handling for max delay */
         PlatformMgr().LockChipStack();
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+        record_lock(site, start);
+#endif
         return SUCCESS;
     }
+    /* The platform does not provide a timed lock, so poll every tick. This gets the lock at most one tick after it is
+    released. */
     uint32_t ticks_remaining = ticks_to_wait;
-    uint32_t ticks = DEFAULT_TICKS;
-    while (ticks_remaining > 0) {
+    while (true) {
         if (PlatformMgr().TryLockChipStack()) {
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+            record_lock(site, start);
+#endif
             return SUCCESS;
         }
-        ticks = ticks_remaining < DEFAULT_TICKS ? ticks_remaining : DEFAULT_TICKS;
-        ticks_remaining -= ticks;
-        ESP_LOGI(TAG, "Did not get lock yet. Retrying...");
-        vTaskDelay(ticks);
+        if (ticks_remaining == 0) {
+            break;
+        }
+        ticks_remaining--;
+        vTaskDelay(1);
     }
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    portENTER_CRITICAL(&stats_spinlock);
+    site_stats[site].timeout_count++;
+    portEXIT_CRITICAL(&stats_spinlock);
+#endif
     ESP_LOGE(TAG, "Could not get lock");
     return FAILED;
 }
 
 esp_err_t chip_stack_unlock()
 {
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    int64_t hold_time = esp_timer_get_time() - locked_at;
+    site_t site = locked_site;
+#endif
     PlatformMgr().UnlockChipStack();
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    portENTER_CRITICAL(&stats_spinlock);
+    record_time(site_stats[site].hold_histogram, &site_stats[site].max_hold_us, hold_time);
+    portEXIT_CRITICAL(&stats_spinlock);
+#endif
+    return ESP_OK;
+}
+
+esp_err_t get_stats(site_t site, stats_t *stats)
+{
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    if (site >= SITE_MAX || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&stats_spinlock);
+    *stats = site_stats[site];
+    portEXIT_CRITICAL(&stats_spinlock);
     return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void print_stats()
+{
+#if CONFIG_ESP_MATTER_LOCK_STATS_ENABLE
+    static const char *site_names[SITE_MAX] = {
+        "other", "attr_update", "attr_get_raw", "attr_get", "attr_cb", "ep_enable", "ep_disable", "nvs", "diagnostics",
+    };
+    printf("Histogram buckets: <100us, <1ms, <10ms, <100ms, <1s, >=1s\n");
+    printf("Site\t\tCount\tTimeout\tWait\t\t\tMax wait(us)\tHold\t\t\tMax hold(us)\n");
+    for (int site = 0; site < SITE_MAX; site++) {
+        stats_t stats;
+        get_stats((site_t)site, &stats);
+        printf("%-12s\t%d\t%d\t", site_names[site], stats.count, stats.timeout_count);
+        for (int i = 0; i < ESP_MATTER_LOCK_HISTOGRAM_SIZE; i++) {
+            printf("%d%c", stats.wait_histogram[i], i < ESP_MATTER_LOCK_HISTOGRAM_SIZE - 1 ? '/' : '\t');
+        }
+        printf("%d\t\t", stats.max_wait_us);
+        for (int i = 0; i < ESP_MATTER_LOCK_HISTOGRAM_SIZE; i++) {
+            printf("%d%c", stats.hold_histogram[i], i < ESP_MATTER_LOCK_HISTOGRAM_SIZE - 1 ? '/' : '\t');
+        }
+        printf("%d\n", stats.max_hold_us);
+    }
+#else
+    printf("Lock statistics: disabled\n");
+#endif
 }
 } /* lock */
 
+namespace startup {
+#if CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE
+/* Time at which each phase ended. These are written by the application task and by the init task on the Matter
+task, which does not run concurrently with it during start(). */
+static int64_t timestamps[PHASE_MAX];
+static const char *phase_names[PHASE_MAX] = {
+    "start", "ota_requestor_init", "memory_init", "init_chip_stack", "start_event_loop", "thread_init",
+    "init_task_scheduled", "server_init", "enable_all", "server_started", "binding_init", "chip_init", "post_init",
+    "read_min_unused_endpoint_id",
+};
+
+/* Duration of the phase, from the end of the previous recorded phase. -1 if the phase has not been recorded. */
+static int64_t get_duration(int phase)
+{
+    if (timestamps[phase] == 0) {
+        return -1;
+    }
+    for (int previous = phase - 1; previous >= 0; previous--) {
+        if (timestamps[previous] != 0) {
+            return timestamps[phase] - timestamps[previous];
+        }
+    }
+    return 0;
+}
+
+static int64_t get_total()
+{
+    for (int phase = PHASE_MAX - 1; phase > PHASE_START; phase--) {
+        if (timestamps[phase] != 0) {
+            return timestamps[phase] - timestamps[PHASE_START];
+        }
+    }
+    return 0;
+}
+#endif /* CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE */
+
+static void record(phase_t phase)
+{
+#if CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE
+    timestamps[phase] = esp_timer_get_time();
+#endif
+}
+
+/* Log the profile as a single line of key=value pairs in microseconds, which is parsed by
+tools/startup_profile/compare_boots.py. The start value is the time since boot at which start() was called. */
+static void log_report()
+{
+#if CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE
+    char line[512];
+    int length = snprintf(line, sizeof(line), "startup_profile: total_us=%lld start_us=%lld", (long long)get_total(),
+                          (long long)timestamps[PHASE_START]);
+    for (int phase = PHASE_START + 1; phase < PHASE_MAX && length < (int)sizeof(line); phase++) {
+        int64_t duration = get_duration(phase);
+        if (duration >= 0) {
+            length += snprintf(line + length, sizeof(line) - length, " %s_us=%lld", phase_names[phase],
+                               (long long)duration);
+        }
+    }
+    ESP_LOGI(TAG, "%s", line);
+#endif
+}
+
+esp_err_t get_timestamp(phase_t phase, int64_t *timestamp_us)
+{
+#if CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE
+    if (phase >= PHASE_MAX || !timestamp_us) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *timestamp_us = timestamps[phase];
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void print_report()
+{
+#if CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE
+    if (timestamps[PHASE_START] == 0) {
+        printf("Startup profile: esp_matter has not started\n");
+        return;
+    }
+    printf("Phase\t\t\t\tDuration(us)\tEnd(us)\n");
+    for (int phase = PHASE_START; phase < PHASE_MAX; phase++) {
+        int64_t duration = get_duration(phase);
+        if (duration >= 0) {
+            printf("%-28s\t%lld\t\t%lld\n", phase_names[phase], (long long)duration, (long long)timestamps[phase]);
+        }
+    }
+    printf("%-28s\t%lld\n", "total", (long long)get_total());
+#else
+    printf("Startup profile: disabled\n");
+#endif
+}
+} /* startup */
+
+namespace pool {
+
+static void add_usage(usage_t *usage, size_t size)
+{
+    usage->size += size;
+    usage->count++;
+}
+
+static void add_attribute_usage(_attribute_t *attribute, data_model_usage_t *usage)
+{
+    add_usage(&usage->objects, sizeof(_attribute_t));
+    if (attribute->val_capacity > 0) {
+        add_usage(&usage->values, attribute->val_capacity);
+    }
+
+    uint32_t default_value_count = 0;
+    usage->default_values.size += attribute::get_default_value_alloc_size(attribute, &default_value_count);
+    usage->default_values.count += default_value_count;
+
+    if (attribute->bounds) {
+        add_usage(&usage->bounds, sizeof(esp_matter_attr_bounds_t));
+    }
+    if (attribute->update_policy) {
+        add_usage(&usage->bounds, sizeof(_update_policy_t));
+    }
+}
+
+static void add_cluster_usage(_cluster_t *cluster, cluster::_shape_t *shape, data_model_usage_t *usage)
+{
+    add_usage(&usage->objects, sizeof(_cluster_t));
+    _attribute_t *attribute = cluster->attribute_list;
+    while (attribute) {
+        add_attribute_usage(attribute, usage);
+        attribute = attribute->next;
+    }
+    _command_t *command = cluster->command_list;
+    while (command) {
+        add_usage(&usage->objects, sizeof(_command_t));
+        command = command->next;
+    }
+    if (shape && shape->ref_count > 0) {
+        usage->metadata.size += shape->size / shape->ref_count;
+        if (shape->ref_count == 1) {
+            usage->metadata.count++;
+        }
+    }
+}
+
+/* Shape of the cluster, if the endpoint is enabled with the generated metadata. See endpoint::get_layout_size(). */
+static cluster::_shape_t *get_shape(_endpoint_t *endpoint, _cluster_t *cluster)
+{
+    const EmberAfEndpointType *endpoint_type = endpoint->endpoint_type;
+    if (!endpoint_type || endpoint->static_endpoint_type) {
+        return NULL;
+    }
+    cluster::_shape_t **shapes = (cluster::_shape_t **)(endpoint_type->cluster + endpoint_type->clusterCount);
+    int cluster_index = 0;
+    _cluster_t *current_cluster = endpoint->cluster_list;
+    while (current_cluster && cluster_index < endpoint_type->clusterCount) {
+        if (current_cluster == cluster) {
+            return shapes[cluster_index];
+        }
+        current_cluster = current_cluster->next;
+        cluster_index++;
+    }
+    return NULL;
+}
+
+static void add_endpoint_usage(_endpoint_t *endpoint, data_model_usage_t *usage)
+{
+    add_usage(&usage->objects, sizeof(_endpoint_t));
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    if (endpoint->nvs_snapshot) {
+        add_usage(&usage->values, endpoint->nvs_snapshot_size);
+    }
+#endif
+    int cluster_count = 0;
+    _cluster_t *cluster = endpoint->cluster_list;
+    while (cluster) {
+        add_cluster_usage(cluster, get_shape(endpoint, cluster), usage);
+        cluster_count++;
+        cluster = cluster->next;
+    }
+    if (endpoint->endpoint_type) {
+        if (endpoint->static_endpoint_type) {
+            cluster_count = endpoint->static_endpoint_type->clusterCount;
+        }
+        add_usage(&usage->metadata, endpoint::get_layout_size(endpoint, cluster_count));
+    }
+    if (endpoint->command_table) {
+        add_usage(&usage->metadata, endpoint->command_count * sizeof(_command_entry_t));
+    }
+}
+
+static void add_total(data_model_usage_t *usage)
+{
+    const usage_t *categories[] = {&usage->objects, &usage->values, &usage->default_values, &usage->bounds,
+                                   &usage->metadata};
+    memset(&usage->total, 0, sizeof(usage_t));
+    for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+        usage->total.size += categories[i]->size;
+        usage->total.count += categories[i]->count;
+    }
+}
+
+static _endpoint_t *get_parent_endpoint(_cluster_t *cluster)
+{
+    _endpoint_t *endpoint = node::node ? node::node->endpoint_list : NULL;
+    while (endpoint && endpoint->endpoint_id != cluster->endpoint_id) {
+        endpoint = endpoint->next;
+    }
+    return endpoint;
+}
+
+/* These must be called with the chip stack lock held */
+static void get_endpoint_usage_locked(_endpoint_t *endpoint, data_model_usage_t *usage)
+{
+    memset(usage, 0, sizeof(data_model_usage_t));
+    add_endpoint_usage(endpoint, usage);
+    add_total(usage);
+}
+
+static void get_cluster_usage_locked(_cluster_t *cluster, _endpoint_t *endpoint, data_model_usage_t *usage)
+{
+    memset(usage, 0, sizeof(data_model_usage_t));
+    add_cluster_usage(cluster, endpoint ? get_shape(endpoint, cluster) : NULL, usage);
+    add_total(usage);
+}
+
+esp_err_t get_endpoint_usage(endpoint_t *endpoint, data_model_usage_t *usage)
+{
+    if (!endpoint || !usage) {
+        ESP_LOGE(TAG, "Endpoint or usage cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Take lock if not already taken. The shared cluster metadata is protected by it. */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_DIAGNOSTICS);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    get_endpoint_usage_locked((_endpoint_t *)endpoint, usage);
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return ESP_OK;
+}
+
+esp_err_t get_cluster_usage(cluster_t *cluster, data_model_usage_t *usage)
+{
+    if (!cluster || !usage) {
+        ESP_LOGE(TAG, "Cluster or usage cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Take lock if not already taken. The shared cluster metadata is protected by it. */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_DIAGNOSTICS);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    _cluster_t *current_cluster = (_cluster_t *)cluster;
+    get_cluster_usage_locked(current_cluster, get_parent_endpoint(current_cluster), usage);
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return ESP_OK;
+}
+
+static void print_usage(const char *name, data_model_usage_t *usage)
+{
+    printf("%-20s\t%d/%d\t\t%d/%d\t\t%d/%d\t\t%d/%d\t\t%d/%d\t\t%d/%d\n", name, (int)usage->objects.size,
+           usage->objects.count, (int)usage->values.size, usage->values.count, (int)usage->default_values.size,
+           usage->default_values.count, (int)usage->bounds.size, usage->bounds.count, (int)usage->metadata.size,
+           usage->metadata.count, (int)usage->total.size, usage->total.count);
+}
+
+void print_data_model_usage()
+{
+    node_t *node = node::get();
+    if (!node) {
+        printf("Data model: not created\n");
+        return;
+    }
+    /* Take lock if not already taken. This is held for the whole walk, so that the endpoints and clusters are not
+    destroyed while they are being printed. */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_DIAGNOSTICS);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return;
+    }
+    printf("Bytes/allocations\tObjects\t\tValues\t\tDefaults\tBounds\t\tMetadata\tTotal\n");
+    data_model_usage_t node_usage;
+    memset(&node_usage, 0, sizeof(data_model_usage_t));
+    int endpoint_count = 0;
+    _endpoint_t *endpoint = ((_node_t *)node)->endpoint_list;
+    while (endpoint) {
+        data_model_usage_t usage;
+        get_endpoint_usage_locked(endpoint, &usage);
+        char name[24];
+        snprintf(name, sizeof(name), "endpoint %d", endpoint->endpoint_id);
+        print_usage(name, &usage);
+        usage_t *categories[] = {&usage.objects, &usage.values, &usage.default_values, &usage.bounds,
+                                 &usage.metadata};
+        usage_t *node_categories[] = {&node_usage.objects, &node_usage.values, &node_usage.default_values,
+                                      &node_usage.bounds, &node_usage.metadata};
+        for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); i++) {
+            node_categories[i]->size += categories[i]->size;
+            node_categories[i]->count += categories[i]->count;
+        }
+        _cluster_t *cluster = endpoint->cluster_list;
+        while (cluster) {
+            get_cluster_usage_locked(cluster, endpoint, &usage);
+            snprintf(name, sizeof(name), "  cluster 0x%04x", (unsigned)cluster->cluster_id);
+            print_usage(name, &usage);
+            cluster = cluster->next;
+        }
+        endpoint_count++;
+        endpoint = endpoint->next;
+    }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    add_total(&node_usage);
+    char name[24];
+    snprintf(name, sizeof(name), "%d endpoints", endpoint_count);
+    print_usage(name, &node_usage);
+}
+
+} /* pool */
+
 static void esp_matter_chip_init_task(intptr_t context)
 {
     xTaskHandle task_to_notify = reinterpret_cast<xTaskHandle>(context);
+    startup::record(startup::PHASE_INIT_TASK_SCHEDULED);
 
     static chip::CommonCaseDeviceServerInitParams initParams;
     initParams.InitializeStaticResourcesBeforeServerInit();
@@ -749,9 +2823,11 @@ static void esp_matter_chip_init_task(intptr_t context)
         chip::app::DnssdServer::Instance().StartServer();
     }
 #endif
+    startup::record(startup::PHASE_SERVER_INIT);
     if (endpoint::enable_all() != ESP_OK) {
         ESP_LOGE(TAG, "Enable all endpoints failure");
     }
+    startup::record(startup::PHASE_ENABLE_ALL);
     // The following two events can't be recorded when we start the server because the endpoints are not enabled.
     // TODO: Find a better way to record the events which should be recorded in matter server init
     // Record start up event in basic information cluster.
@@ -768,8 +2844,10 @@ static void esp_matter_chip_init_task(intptr_t context)
         sWiFiNetworkCommissioningInstance.Init();
     }
 #endif
+    startup::record(startup::PHASE_SERVER_STARTED);
     /* Initialize binding manager */
     client::binding_manager_init();
+    startup::record(startup::PHASE_BINDING_INIT);
     xTaskNotifyGive(task_to_notify);
 }
 
@@ -850,10 +2928,12 @@ static esp_err_t chip_init(event_callback_t callback)
         ESP_LOGE(TAG, "Failed to initialize CHIP memory pool");
         return ESP_ERR_NO_MEM;
     }
+    startup::record(startup::PHASE_MEMORY_INIT);
     if (PlatformMgr().InitChipStack() != CHIP_NO_ERROR) {
         ESP_LOGE(TAG, "Failed to initialize CHIP stack");
         return ESP_FAIL;
     }
+    startup::record(startup::PHASE_INIT_CHIP_STACK);
 
 /* TODO: Remove the examples DAC provider once we have a concrete
  * way to generate attestation credentials.
@@ -878,31 +2958,98 @@ static esp_err_t chip_init(event_callback_t callback)
     }
     PlatformMgr().AddEventHandler(device_callback_internal, static_cast<intptr_t>(NULL));
     PlatformMgr().AddEventHandler(callback, static_cast<intptr_t>(NULL));
+    startup::record(startup::PHASE_START_EVENT_LOOP);
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD
     if (ThreadStackMgr().InitThreadStack() != CHIP_NO_ERROR) {
         ESP_LOGE(TAG, "Failed to initialize Thread stack");
         return ESP_FAIL;
     }
 
-    if (ThreadStackMgr().StartThreadTask() != CHIP_NO_ERROR) {
-        ESP_LOGE(TAG, "Failed to launch Thread task");
-        return ESP_FAIL;
-    }
-#endif
+    if (ThreadStackMgr().StartThreadTask() != CHIP_NO_ERROR) {
+        ESP_LOGE(TAG, "Failed to launch Thread task");
+        return ESP_FAIL;
+    }
+    startup::record(startup::PHASE_THREAD_INIT);
+#endif
+
+    PlatformMgr().ScheduleWork(esp_matter_chip_init_task, reinterpret_cast<intptr_t>(xTaskGetCurrentTaskHandle()));
+    // Wait for the matter stack to be initialized
+    xTaskNotifyWait(0, 0, NULL, portMAX_DELAY);
+    startup::record(startup::PHASE_CHIP_INIT);
+    return ESP_OK;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t pool_console_handler(int argc, char **argv)
+{
+    pool::print_stats();
+    cluster::print_shape_stats();
+    return ESP_OK;
+}
+
+static esp_err_t lock_console_handler(int argc, char **argv)
+{
+    lock::print_stats();
+    return ESP_OK;
+}
+
+static esp_err_t startup_console_handler(int argc, char **argv)
+{
+    startup::print_report();
+    return ESP_OK;
+}
 
-    PlatformMgr().ScheduleWork(esp_matter_chip_init_task, reinterpret_cast<intptr_t>(xTaskGetCurrentTaskHandle()));
-    // Wait for the matter stack to be initialized
-    xTaskNotifyWait(0, 0, NULL, portMAX_DELAY);
+static esp_err_t data_model_console_handler(int argc, char **argv)
+{
+    pool::print_data_model_usage();
     return ESP_OK;
 }
 
+static void register_console_commands()
+{
+    static const console::command_t diagnostics_commands[] = {
+        {
+            .name = "pool",
+            .description = "print the data model allocation statistics",
+            .handler = pool_console_handler,
+        },
+        {
+            .name = "lock",
+            .description = "print the chip stack lock wait and hold time statistics",
+            .handler = lock_console_handler,
+        },
+        {
+            .name = "startup",
+            .description = "print the duration of the esp_matter::start() phases",
+            .handler = startup_console_handler,
+        },
+        {
+            .name = "data-model",
+            .description = "print the memory used by each endpoint and cluster of the data model",
+            .handler = data_model_console_handler,
+        },
+    };
+    console::diagnostics_add_commands(diagnostics_commands,
+                                      sizeof(diagnostics_commands) / sizeof(console::command_t));
+}
+#endif // CONFIG_ENABLE_CHIP_SHELL
+
+/* The chip stack lock cannot be taken before start, since the stack has not been initialized */
+bool is_started()
+{
+    return esp_matter_started;
+}
+
 esp_err_t start(event_callback_t callback)
 {
     if (esp_matter_started) {
         ESP_LOGE(TAG, "esp_matter has started");
         return ESP_ERR_INVALID_STATE;
     }
+    startup::record(startup::PHASE_START);
+    pool::record_heap_info(&pool::heap_info_after);
     esp_matter_ota_requestor_init();
+    startup::record(startup::PHASE_OTA_REQUESTOR_INIT);
 
     esp_err_t err = chip_init(callback);
     if (err != ESP_OK) {
@@ -910,11 +3057,28 @@ esp_err_t start(event_callback_t callback)
         return err;
     }
     esp_matter_started = true;
+#if CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE
+    esp_register_shutdown_handler(attribute::nvs_flush_shutdown_handler);
+    if (attribute::is_dirty()) {
+        attribute::nvs_flush_timer_start();
+    }
+#elif CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    /* Store the snapshots of the endpoints created (or migrated) before start */
+    if (attribute::is_dirty()) {
+        attribute::flush_nvs();
+    }
+#endif
+#if CONFIG_ENABLE_CHIP_SHELL
+    register_console_commands();
+#endif
+    startup::record(startup::PHASE_POST_INIT);
     err = node::read_min_unused_endpoint_id();
     // If the min_unused_endpoint_id is not found, we will write the current min_unused_endpoint_id in nvs.
     if (err == ESP_ERR_NVS_NOT_FOUND) {
         err = node::store_min_unused_endpoint_id();
     }
+    startup::record(startup::PHASE_READ_MIN_UNUSED_ENDPOINT_ID);
+    startup::log_report();
     return err;
 }
 
@@ -924,6 +3088,7 @@ esp_err_t factory_reset()
     node_t *node = node::get();
     if (node) {
         /* ESP Matter data model is used. Erase all the data that we have added in nvs. */
+        attribute::discard_dirty_nvs();
         nvs_handle_t node_handle;
         err = nvs_open_from_partition(ESP_MATTER_NVS_PART_NAME, ESP_MATTER_NVS_NODE_NAMESPACE,
                                       NVS_READWRITE, &node_handle);
@@ -961,6 +3126,108 @@ esp_err_t factory_reset()
 }
 
 namespace attribute {
+/* Returns the heap buffer of the string value of the attribute, or NULL if the value is stored inline or empty */
+static uint8_t *get_heap_buf(_attribute_t *current_attribute)
+{
+    if (!is_string_type(current_attribute->val.type) || current_attribute->val_capacity == 0) {
+        return NULL;
+    }
+    return current_attribute->val.val.a.b;
+}
+
+static void free_heap_buf(_attribute_t *current_attribute)
+{
+    uint8_t *heap_buf = get_heap_buf(current_attribute);
+    if (heap_buf) {
+        free(heap_buf);
+    }
+    current_attribute->val_capacity = 0;
+}
+
+static esp_err_t copy_val(_attribute_t *current_attribute, esp_matter_attr_val_t *val)
+{
+    if (is_string_type(val->type)) {
+        /* The new value can be in the current buffer of the attribute, so that is freed only after the copy */
+        uint8_t *heap_buf = get_heap_buf(current_attribute);
+        uint16_t size = val->val.a.s;
+        uint8_t *new_buf = NULL;
+        if (size > 0) {
+#if CONFIG_ESP_MATTER_ATTRIBUTE_INLINE_VAL_SIZE > 0
+            if (size <= CONFIG_ESP_MATTER_ATTRIBUTE_INLINE_VAL_SIZE) {
+                new_buf = current_attribute->val_inline;
+            } else
+#endif
+            if (heap_buf && current_attribute->val_capacity >= size) {
+                new_buf = heap_buf;
+            } else {
+                new_buf = (uint8_t *)malloc(size);
+                if (!new_buf) {
+                    ESP_LOGE(TAG, "Could not allocate new buffer");
+                    return ESP_ERR_NO_MEM;
+                }
+            }
+            memmove(new_buf, val->val.a.b, size);
+        } else {
+            ESP_LOGD(TAG, "Set val called with string with size 0");
+        }
+        if (new_buf != heap_buf) {
+            free_heap_buf(current_attribute);
+#if CONFIG_ESP_MATTER_ATTRIBUTE_INLINE_VAL_SIZE > 0
+            if (new_buf != current_attribute->val_inline) {
+                current_attribute->val_capacity = size;
+            }
+#else
+            current_attribute->val_capacity = size;
+#endif
+        }
+        val->val.a.b = new_buf;
+    } else {
+        free_heap_buf(current_attribute);
+    }
+    memcpy((void *)&current_attribute->val, (void *)val, sizeof(esp_matter_attr_val_t));
+    return ESP_OK;
+}
+
+/* This runs on the chip thread, with the chip stack lock held */
+static void pending_update_timer_cb(chip::System::Layer *layer, void *context)
+{
+    _attribute_t *current_attribute = (_attribute_t *)context;
+    _update_policy_t *update_policy = current_attribute->update_policy;
+    if (!update_policy || !update_policy->pending) {
+        return;
+    }
+    /* The interval has expired, so the update goes through the policy again. If it is still held back, it stays
+    pending for the max interval. */
+    update_policy->pending = false;
+    esp_matter_attr_val_t val = update_policy->pending_val;
+    update_locked(current_attribute->endpoint_id, current_attribute->cluster_id, current_attribute->attribute_id, &val);
+}
+
+/* This must be called with the chip stack lock held */
+static void schedule_pending_update(_attribute_t *current_attribute, esp_matter_attr_val_t *val, uint32_t delay_ms)
+{
+    _update_policy_t *update_policy = current_attribute->update_policy;
+    /* Starting the timer again replaces the previous one, so only the latest value is applied */
+    CHIP_ERROR err = chip::DeviceLayer::SystemLayer().StartTimer(chip::System::Clock::Milliseconds32(delay_ms),
+                                                                 pending_update_timer_cb, current_attribute);
+    if (err != CHIP_NO_ERROR) {
+        ESP_LOGE(TAG, "Could not start the update policy timer: %" CHIP_ERROR_FORMAT, err.Format());
+        return;
+    }
+    update_policy->pending_val = *val;
+    update_policy->pending = true;
+}
+
+/* This must be called with the chip stack lock held */
+static void cancel_pending_update(_attribute_t *current_attribute)
+{
+    _update_policy_t *update_policy = current_attribute->update_policy;
+    if (update_policy->pending) {
+        chip::DeviceLayer::SystemLayer().CancelTimer(pending_update_timer_cb, current_attribute);
+        update_policy->pending = false;
+    }
+}
+
 attribute_t *create(cluster_t *cluster, uint32_t attribute_id, uint8_t flags, esp_matter_attr_val_t val)
 {
     /* Find */
@@ -977,7 +3244,7 @@ attribute_t *create(cluster_t *cluster, uint32_t attribute_id, uint8_t flags, es
     }
 
     /* Allocate */
-    _attribute_t *attribute = (_attribute_t *)calloc(1, sizeof(_attribute_t));
+    _attribute_t *attribute = (_attribute_t *)pool::alloc_object(pool::TYPE_ATTRIBUTE);
     if (!attribute) {
         ESP_LOGE(TAG, "Couldn't allocate _attribute_t");
         return NULL;
@@ -990,30 +3257,36 @@ attribute_t *create(cluster_t *cluster, uint32_t attribute_id, uint8_t flags, es
     attribute->flags = flags;
     attribute->flags |= ATTRIBUTE_FLAG_EXTERNAL_STORAGE;
     if (attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
+        /* The type and the size of the length prefix of val are needed for reading the value */
+        attribute->val = val;
+        if (is_string_type(val.type)) {
+            attribute->val.val.a.b = NULL;
+        }
         esp_matter_attr_val_t val_nvs = esp_matter_invalid(NULL);
-        esp_err_t err = get_val_from_nvs((attribute_t *)attribute, &val_nvs);
+        esp_err_t err = restore_val(attribute, &val_nvs);
         if (err == ESP_OK) {
-            set_val((attribute_t *)attribute, &val_nvs);
+            /* The value is already in nvs, so it is not stored again */
+            uint8_t *nvs_buffer = is_string_type(val_nvs.type) ? val_nvs.val.a.b : NULL;
+            copy_val(attribute, &val_nvs);
+            free(nvs_buffer);
         } else {
-            set_val((attribute_t *)attribute, &val);
+            /* Not set_val(), which would skip the preset val as unchanged, without copying or storing it */
+            copy_val(attribute, &val);
+            persist_val(attribute);
         }
     } else {
-        set_val((attribute_t *)attribute, &val);
+        copy_val(attribute, &val);
     }
     set_default_value_from_current_val((attribute_t *)attribute);
 
     /* Add */
-    _attribute_t *previous_attribute = NULL;
-    _attribute_t *current_attribute = current_cluster->attribute_list;
-    while (current_attribute) {
-        previous_attribute = current_attribute;
-        current_attribute = current_attribute->next;
-    }
-    if (previous_attribute == NULL) {
+    if (current_cluster->attribute_list_tail == NULL) {
         current_cluster->attribute_list = attribute;
     } else {
-        previous_attribute->next = attribute;
+        current_cluster->attribute_list_tail->next = attribute;
     }
+    current_cluster->attribute_list_tail = attribute;
+    attribute_id_filter_add(&current_cluster->attribute_id_filter, attribute_id);
 
     return (attribute_t *)attribute;
 }
@@ -1026,26 +3299,31 @@ static esp_err_t destroy(attribute_t *attribute)
     }
     _attribute_t *current_attribute = (_attribute_t *)attribute;
 
+    /* Make sure that the index does not keep a stale entry */
+    index_remove(current_attribute);
+
+    /* Invalidate the attribute caches */
+    invalidate_caches();
+
     /* Default value needs to be deleted first since it uses the current val. */
     free_default_value(attribute);
 
     /* Delete val here, if required */
-    if (current_attribute->val.type == ESP_MATTER_VAL_TYPE_CHAR_STRING ||
-        current_attribute->val.type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
-        current_attribute->val.type == ESP_MATTER_VAL_TYPE_ARRAY) {
-        /* Free buf */
-        if (current_attribute->val.val.a.b) {
-            free(current_attribute->val.val.a.b);
-        }
-    }
+    free_heap_buf(current_attribute);
 
     /* Free bounds */
     if (current_attribute->bounds) {
-        free(current_attribute->bounds);
+        pool::free_object(pool::TYPE_BOUNDS, current_attribute->bounds);
+    }
+
+    /* Free update policy */
+    if (current_attribute->update_policy) {
+        cancel_pending_update(current_attribute);
+        free(current_attribute->update_policy);
     }
 
     /* Free */
-    free(current_attribute);
+    pool::free_object(pool::TYPE_ATTRIBUTE, current_attribute);
     return ESP_OK;
 }
 
@@ -1056,6 +3334,9 @@ attribute_t *get(cluster_t *cluster, uint32_t attribute_id)
         return NULL;
     }
     _cluster_t *current_cluster = (_cluster_t *)cluster;
+    if (!attribute_id_filter_may_contain(&current_cluster->attribute_id_filter, attribute_id)) {
+        return NULL;
+    }
     _attribute_t *current_attribute = (_attribute_t *)current_cluster->attribute_list;
     while (current_attribute) {
         if (current_attribute->attribute_id == attribute_id) {
@@ -1066,6 +3347,65 @@ attribute_t *get(cluster_t *cluster, uint32_t attribute_id)
     return (attribute_t *)current_attribute;
 }
 
+attribute_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    _attribute_t *current_attribute = index_find(endpoint_id, cluster_id, attribute_id);
+    if (current_attribute) {
+        return (attribute_t *)current_attribute;
+    }
+
+    /* Not indexed (endpoint not enabled yet or attribute added later): walk the data model */
+    node_t *node = node::get();
+    if (!node) {
+        return NULL;
+    }
+    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
+    cluster_t *cluster = cluster::get(endpoint, cluster_id);
+    return get(cluster, attribute_id);
+}
+
+attribute_t *get(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    if (!cache) {
+        ESP_LOGE(TAG, "Cache cannot be NULL");
+        return NULL;
+    }
+    portENTER_CRITICAL(&cache_spinlock);
+    uint32_t generation = cache_generation;
+    attribute_t *attribute = NULL;
+    if (cache->attribute && cache->endpoint_id == endpoint_id && cache->cluster_id == cluster_id &&
+        cache->attribute_id == attribute_id && cache->generation == generation) {
+        attribute = cache->attribute;
+    }
+    portEXIT_CRITICAL(&cache_spinlock);
+    if (attribute) {
+        return attribute;
+    }
+
+    /* Only the attributes of the enabled endpoints are indexed, and they are the ones in the Ember metadata */
+    bool enabled = true;
+    attribute = (attribute_t *)index_find(endpoint_id, cluster_id, attribute_id);
+    if (!attribute) {
+        enabled = false;
+        attribute = get(endpoint_id, cluster_id, attribute_id);
+    }
+    if (!attribute) {
+        return NULL;
+    }
+    portENTER_CRITICAL(&cache_spinlock);
+    /* Only cache the attribute if nothing was destroyed while resolving it */
+    if (generation == cache_generation) {
+        cache->attribute = attribute;
+        cache->endpoint_id = endpoint_id;
+        cache->cluster_id = cluster_id;
+        cache->attribute_id = attribute_id;
+        cache->generation = generation;
+        cache->enabled = enabled;
+    }
+    portEXIT_CRITICAL(&cache_spinlock);
+    return attribute;
+}
+
 attribute_t *get_first(cluster_t *cluster)
 {
     if (!cluster) {
@@ -1103,30 +3443,47 @@ esp_err_t set_val(attribute_t *attribute, esp_matter_attr_val_t *val)
         return ESP_FAIL;
     }
     _attribute_t *current_attribute = (_attribute_t *)attribute;
-    if (val->type == ESP_MATTER_VAL_TYPE_CHAR_STRING || val->type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
-        val->type == ESP_MATTER_VAL_TYPE_ARRAY) {
-        /* Free old buf */
-        if (current_attribute->val.val.a.b) {
-            free(current_attribute->val.val.a.b);
-        }
-        if (val->val.a.s > 0) {
-            /* Alloc new buf */
-            uint8_t *new_buf = (uint8_t *)calloc(1, val->val.a.s);
-            if (!new_buf) {
-                ESP_LOGE(TAG, "Could not allocate new buffer");
-                return ESP_ERR_NO_MEM;
-            }
-            /* Copy to new buf and assign */
-            memcpy(new_buf, val->val.a.b, val->val.a.s);
-            val->val.a.b = new_buf;
-        } else {
-            ESP_LOGD(TAG, "Set val called with string with size 0");
-            val->val.a.b = NULL;
+    if (val_is_unchanged(current_attribute, val)) {
+        return ESP_OK;
+    }
+    esp_err_t err = copy_val(current_attribute, val);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (current_attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
+        persist_val(current_attribute);
+    }
+    return ESP_OK;
+}
+
+esp_err_t set_val_no_copy(attribute_t *attribute, esp_matter_attr_val_t *val)
+{
+    if (!val || !is_string_type(val->type)) {
+        return set_val(attribute, val);
+    }
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        free(val->val.a.b);
+        return ESP_FAIL;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+    if (val_is_unchanged(current_attribute, val)) {
+        if (val->val.a.b != current_attribute->val.val.a.b) {
+            free(val->val.a.b);
         }
+        return ESP_OK;
+    }
+    if (val->val.a.b != get_heap_buf(current_attribute)) {
+        free_heap_buf(current_attribute);
+    }
+    if (val->val.a.s == 0) {
+        free(val->val.a.b);
+        val->val.a.b = NULL;
     }
+    current_attribute->val_capacity = val->val.a.s;
     memcpy((void *)&current_attribute->val, (void *)val, sizeof(esp_matter_attr_val_t));
     if (current_attribute->flags & ATTRIBUTE_FLAG_NONVOLATILE) {
-        store_val_in_nvs(attribute);
+        persist_val(current_attribute);
     }
     return ESP_OK;
 }
@@ -1167,7 +3524,7 @@ esp_err_t add_bounds(attribute_t *attribute, esp_matter_attr_val_t min, esp_matt
     free_default_value(attribute);
 
     /* Allocate and set */
-    current_attribute->bounds = (esp_matter_attr_bounds_t *)calloc(1, sizeof(esp_matter_attr_bounds_t));
+    current_attribute->bounds = (esp_matter_attr_bounds_t *)pool::alloc_object(pool::TYPE_BOUNDS);
     if (!current_attribute->bounds) {
         ESP_LOGE(TAG, "Could not allocate bounds");
         return ESP_ERR_NO_MEM;
@@ -1191,6 +3548,126 @@ esp_matter_attr_bounds_t *get_bounds(attribute_t *attribute)
     return current_attribute->bounds;
 }
 
+esp_err_t set_update_policy(attribute_t *attribute, const update_policy_t *policy)
+{
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+
+    /* Check if the policy can be set */
+    if (current_attribute->val.type == ESP_MATTER_VAL_TYPE_CHAR_STRING ||
+        current_attribute->val.type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
+        current_attribute->val.type == ESP_MATTER_VAL_TYPE_ARRAY) {
+        ESP_LOGE(TAG, "Update policy cannot be set for string/array type attributes");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!policy) {
+        if (current_attribute->update_policy) {
+            cancel_pending_update(current_attribute);
+            free(current_attribute->update_policy);
+            current_attribute->update_policy = NULL;
+        }
+        return ESP_OK;
+    }
+    if (!current_attribute->update_policy) {
+        current_attribute->update_policy = (_update_policy_t *)calloc(1, sizeof(_update_policy_t));
+        if (!current_attribute->update_policy) {
+            ESP_LOGE(TAG, "Could not allocate update policy");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    memcpy(&current_attribute->update_policy->policy, policy, sizeof(update_policy_t));
+    return ESP_OK;
+}
+
+const update_policy_t *get_update_policy(attribute_t *attribute)
+{
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        return NULL;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+    if (!current_attribute->update_policy) {
+        return NULL;
+    }
+    return &current_attribute->update_policy->policy;
+}
+
+/* Check the update against the current val and the update policy of the attribute. This returns false if the update
+should be dropped. The attribute is looked up from the path if it is NULL. This is called with the chip stack lock
+held. */
+bool check_update(attribute_t *attribute, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                  esp_matter_attr_val_t *val)
+{
+    if (!attribute) {
+        attribute = get(endpoint_id, cluster_id, attribute_id);
+        if (!attribute) {
+            return true;
+        }
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+    if (val_is_unchanged(current_attribute, val)) {
+        ESP_LOGD(TAG, "Update of endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X skipped, the value is unchanged",
+                 endpoint_id, cluster_id, attribute_id);
+        /* The latest sample is the current val, so a held back update is stale */
+        if (current_attribute->update_policy) {
+            cancel_pending_update(current_attribute);
+        }
+        return false;
+    }
+    _update_policy_t *update_policy = current_attribute->update_policy;
+    if (!update_policy) {
+        return true;
+    }
+    update_policy_t *policy = &update_policy->policy;
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed_ms = (now - update_policy->last_update_us) / 1000;
+
+    bool apply = true;
+    /* Time after which the held back update is applied. 0 if it is dropped. */
+    uint32_t pending_delay_ms = 0;
+    if (update_policy->last_update_us == 0 || (policy->max_interval_ms && elapsed_ms >= policy->max_interval_ms)) {
+        apply = true;
+    } else if (policy->min_interval_ms && elapsed_ms < policy->min_interval_ms) {
+        apply = false;
+        pending_delay_ms = policy->min_interval_ms - elapsed_ms;
+    } else if (val_is_null(val) || val_is_null(&current_attribute->val)) {
+        /* Changes from or to null are always applied */
+        apply = val_is_null(val) != val_is_null(&current_attribute->val);
+    } else {
+        double current_value = 0, new_value = 0;
+        if (get_val_as_double(&current_attribute->val, &current_value) == ESP_OK &&
+            get_val_as_double(val, &new_value) == ESP_OK) {
+            double delta = new_value > current_value ? new_value - current_value : current_value - new_value;
+            double current_abs = current_value < 0 ? -current_value : current_value;
+            if (policy->min_delta > 0 && delta < policy->min_delta) {
+                apply = false;
+            }
+            if (policy->min_delta_percent > 0 && delta * 100 < current_abs * policy->min_delta_percent) {
+                apply = false;
+            }
+        }
+        if (!apply && policy->max_interval_ms) {
+            pending_delay_ms = policy->max_interval_ms - elapsed_ms;
+        }
+    }
+    if (apply) {
+        update_policy->last_update_us = now;
+        cancel_pending_update(current_attribute);
+    } else if (pending_delay_ms > 0) {
+        ESP_LOGD(TAG, "Update of endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X held back for %d ms",
+                 endpoint_id, cluster_id, attribute_id, pending_delay_ms);
+        schedule_pending_update(current_attribute, val, pending_delay_ms);
+    } else {
+        ESP_LOGD(TAG, "Update of endpoint 0x%04X's cluster 0x%04X's attribute 0x%04X dropped by its update policy",
+                 endpoint_id, cluster_id, attribute_id);
+    }
+    return apply;
+}
+
 uint16_t get_flags(attribute_t *attribute)
 {
     if (!attribute) {
@@ -1201,6 +3678,21 @@ uint16_t get_flags(attribute_t *attribute)
     return current_attribute->flags;
 }
 
+esp_err_t set_write_always(attribute_t *attribute, bool write_always)
+{
+    if (!attribute) {
+        ESP_LOGE(TAG, "Attribute cannot be NULL");
+        return ESP_ERR_INVALID_ARG;
+    }
+    _attribute_t *current_attribute = (_attribute_t *)attribute;
+    if (write_always) {
+        current_attribute->flags |= ATTRIBUTE_FLAG_WRITE_ALWAYS;
+    } else {
+        current_attribute->flags &= ~ATTRIBUTE_FLAG_WRITE_ALWAYS;
+    }
+    return ESP_OK;
+}
+
 esp_err_t set_override_callback(attribute_t *attribute, callback_t callback)
 {
     if (!attribute) {
@@ -1230,41 +3722,54 @@ esp_err_t store_val_in_nvs(attribute_t *attribute)
         return ESP_ERR_INVALID_ARG;
     }
     _attribute_t *current_attribute = (_attribute_t *)attribute;
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    _endpoint_t *endpoint = get_endpoint(current_attribute->endpoint_id);
+    if (endpoint && is_snapshot_deferred(endpoint)) {
+        /* Stored with the complete endpoint, see persist_val() */
+        current_attribute->nvs_dirty = true;
+        endpoint->nvs_dirty = true;
+        return ESP_OK;
+    }
+#endif
 
     /* Get keys */
-    uint32_t attribute_id = current_attribute->attribute_id;
-    uint32_t cluster_id = current_attribute->cluster_id;
-    uint16_t endpoint_id = current_attribute->endpoint_id;
     char nvs_namespace[16] = {0};
-    char attribute_key[16] = {0};
-    snprintf(nvs_namespace, 16, "endpoint_%X", endpoint_id); /* endpoint_id */
-    snprintf(attribute_key, 16, "%X:%X", cluster_id, attribute_id); /* cluster_id:attribute_id */
+    snprintf(nvs_namespace, 16, "endpoint_%X", current_attribute->endpoint_id); /* endpoint_id */
 
     nvs_handle_t handle;
     esp_err_t err = nvs_open_from_partition(ESP_MATTER_NVS_PART_NAME, nvs_namespace, NVS_READWRITE, &handle);
     if (err != ESP_OK) {
         return err;
     }
-    ESP_LOGD(TAG, "strore attribute in nvs: endpoint_id-0x%x, cluster_id-0x%x, attribute_id-0x%x",
-             endpoint_id, cluster_id, attribute_id);
-    if (current_attribute->val.type == ESP_MATTER_VAL_TYPE_CHAR_STRING ||
-        current_attribute->val.type == ESP_MATTER_VAL_TYPE_OCTET_STRING ||
-        current_attribute->val.type == ESP_MATTER_VAL_TYPE_ARRAY) {
-        /* Store only if value is not NULL */
-        if (current_attribute->val.val.a.b) {
-            err = nvs_set_blob(handle, attribute_key, current_attribute->val.val.a.b, current_attribute->val.val.a.s);
-            nvs_commit(handle);
-        } else {
-            err = ESP_OK;
-        }
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    if (endpoint) {
+        err = store_snapshot(handle, endpoint);
     } else {
-        err = nvs_set_blob(handle, attribute_key, &current_attribute->val, sizeof(esp_matter_attr_val_t));
-        nvs_commit(handle);
+        err = store_val(handle, current_attribute);
     }
+#else
+    err = store_val(handle, current_attribute);
+#endif
+    nvs_commit(handle);
     nvs_close(handle);
     return err;
 }
 
+esp_err_t flush_nvs()
+{
+    /* Take lock if not already taken */
+    lock::status_t lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_NVS);
+    if (lock_status == lock::FAILED) {
+        ESP_LOGE(TAG, "Could not get task context");
+        return ESP_FAIL;
+    }
+    esp_err_t err = flush_all_nvs();
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
+    return err;
+}
+
 esp_err_t get_val_from_nvs(attribute_t *attribute, esp_matter_attr_val_t *val)
 {
     if (!attribute) {
@@ -1333,7 +3838,7 @@ command_t *create(cluster_t *cluster, uint32_t command_id, uint8_t flags, callba
     }
 
     /* Allocate */
-    _command_t *command = (_command_t *)calloc(1, sizeof(_command_t));
+    _command_t *command = (_command_t *)pool::alloc_object(pool::TYPE_COMMAND);
     if (!command) {
         ESP_LOGE(TAG, "Couldn't allocate _command_t");
         return NULL;
@@ -1345,17 +3850,13 @@ command_t *create(cluster_t *cluster, uint32_t command_id, uint8_t flags, callba
     command->callback = callback;
 
     /* Add */
-    _command_t *previous_command = NULL;
-    _command_t *current_command = current_cluster->command_list;
-    while (current_command) {
-        previous_command = current_command;
-        current_command = current_command->next;
-    }
-    if (previous_command == NULL) {
+    if (current_cluster->command_list_tail == NULL) {
         current_cluster->command_list = command;
     } else {
-        previous_command->next = command;
+        current_cluster->command_list_tail->next = command;
     }
+    current_cluster->command_list_tail = command;
+    current_cluster->command_id_filter |= get_id_filter_bit(command_id);
 
     return (command_t *)command;
 }
@@ -1369,7 +3870,7 @@ static esp_err_t destroy(command_t *command)
     _command_t *current_command = (_command_t *)command;
 
     /* Free */
-    free(current_command);
+    pool::free_object(pool::TYPE_COMMAND, current_command);
     return ESP_OK;
 }
 
@@ -1380,6 +3881,9 @@ command_t *get(cluster_t *cluster, uint32_t command_id, uint16_t flags)
         return NULL;
     }
     _cluster_t *current_cluster = (_cluster_t *)cluster;
+    if (!(current_cluster->command_id_filter & get_id_filter_bit(command_id))) {
+        return NULL;
+    }
     _command_t *current_command = (_command_t *)current_cluster->command_list;
     while (current_command) {
         if ((current_command->command_id == command_id) && (current_command->flags & flags)) {
@@ -1390,6 +3894,26 @@ command_t *get(cluster_t *cluster, uint32_t command_id, uint16_t flags)
     return (command_t *)current_command;
 }
 
+command_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id)
+{
+    _endpoint_t *enabled_endpoint = endpoint::enabled_endpoint_find(endpoint_id);
+    if (enabled_endpoint) {
+        _command_t *current_command = table_find(enabled_endpoint, cluster_id, command_id);
+        if (current_command) {
+            return (command_t *)current_command;
+        }
+    }
+
+    /* Not in a command table (endpoint not enabled or command added later): walk the data model */
+    node_t *node = node::get();
+    if (!node) {
+        return NULL;
+    }
+    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
+    cluster_t *cluster = cluster::get(endpoint, cluster_id);
+    return get(cluster, command_id, COMMAND_FLAG_ACCEPTED);
+}
+
 command_t *get_first(cluster_t *cluster)
 {
     if (!cluster) {
@@ -1481,7 +4005,7 @@ cluster_t *create(endpoint_t *endpoint, uint32_t cluster_id, uint8_t flags)
     }
 
     /* Allocate */
-    _cluster_t *cluster = (_cluster_t *)calloc(1, sizeof(_cluster_t));
+    _cluster_t *cluster = (_cluster_t *)pool::alloc_object(pool::TYPE_CLUSTER);
     if (!cluster) {
         ESP_LOGE(TAG, "Couldn't allocate _cluster_t");
         return NULL;
@@ -1493,17 +4017,13 @@ cluster_t *create(endpoint_t *endpoint, uint32_t cluster_id, uint8_t flags)
     cluster->flags = flags;
 
     /* Add */
-    _cluster_t *previous_cluster = NULL;
-    _cluster_t *current_cluster = current_endpoint->cluster_list;
-    while (current_cluster) {
-        previous_cluster = current_cluster;
-        current_cluster = current_cluster->next;
-    }
-    if (previous_cluster == NULL) {
+    if (current_endpoint->cluster_list_tail == NULL) {
         current_endpoint->cluster_list = cluster;
     } else {
-        previous_cluster->next = cluster;
+        current_endpoint->cluster_list_tail->next = cluster;
     }
+    current_endpoint->cluster_list_tail = cluster;
+    current_endpoint->cluster_id_filter |= get_id_filter_bit(cluster_id);
 
     return (cluster_t *)cluster;
 }
@@ -1533,7 +4053,7 @@ static esp_err_t destroy(cluster_t *cluster)
     }
 
     /* Free */
-    free(current_cluster);
+    pool::free_object(pool::TYPE_CLUSTER, current_cluster);
     return ESP_OK;
 }
 
@@ -1544,6 +4064,9 @@ cluster_t *get(endpoint_t *endpoint, uint32_t cluster_id)
         return NULL;
     }
     _endpoint_t *current_endpoint = (_endpoint_t *)endpoint;
+    if (!(current_endpoint->cluster_id_filter & get_id_filter_bit(cluster_id))) {
+        return NULL;
+    }
     _cluster_t *current_cluster = (_cluster_t *)current_endpoint->cluster_list;
     while (current_cluster) {
         if (current_cluster->cluster_id == cluster_id) {
@@ -1652,7 +4175,7 @@ endpoint_t *create(node_t *node, uint8_t flags, void *priv_data)
     _node_t *current_node = (_node_t *)node;
 
     /* Allocate */
-    _endpoint_t *endpoint = (_endpoint_t *)calloc(1, sizeof(_endpoint_t));
+    _endpoint_t *endpoint = (_endpoint_t *)pool::alloc_object(pool::TYPE_ENDPOINT);
     if (!endpoint) {
         ESP_LOGE(TAG, "Couldn't allocate _endpoint_t");
         return NULL;
@@ -1662,6 +4185,7 @@ endpoint_t *create(node_t *node, uint8_t flags, void *priv_data)
     endpoint->endpoint_id = current_node->min_unused_endpoint_id++;
     endpoint->device_type_count = 0;
     endpoint->flags = flags;
+    endpoint->endpoint_index = 0xFFFF;
     endpoint->priv_data = priv_data;
 
     /* Store */
@@ -1670,17 +4194,12 @@ endpoint_t *create(node_t *node, uint8_t flags, void *priv_data)
     }
 
     /* Add */
-    _endpoint_t *previous_endpoint = NULL;
-    _endpoint_t *current_endpoint = current_node->endpoint_list;
-    while (current_endpoint) {
-        previous_endpoint = current_endpoint;
-        current_endpoint = current_endpoint->next;
-    }
-    if (previous_endpoint == NULL) {
+    if (current_node->endpoint_list_tail == NULL) {
         current_node->endpoint_list = endpoint;
     } else {
-        previous_endpoint->next = endpoint;
+        current_node->endpoint_list_tail->next = endpoint;
     }
+    current_node->endpoint_list_tail = endpoint;
 
     return (endpoint_t *)endpoint;
 }
@@ -1711,7 +4230,7 @@ endpoint_t *resume(node_t *node, uint8_t flags, uint16_t endpoint_id, void *priv
      }
 
      /* Allocate */
-     _endpoint_t *endpoint = (_endpoint_t *)calloc(1, sizeof(_endpoint_t));
+     _endpoint_t *endpoint = (_endpoint_t *)pool::alloc_object(pool::TYPE_ENDPOINT);
      if (!endpoint) {
          ESP_LOGE(TAG, "Couldn't allocate _endpoint_t");
          return NULL;
@@ -1721,6 +4240,7 @@ endpoint_t *resume(node_t *node, uint8_t flags, uint16_t endpoint_id, void *priv
      endpoint->endpoint_id = endpoint_id;
      endpoint->device_type_count = 0;
      endpoint->flags = flags;
+     endpoint->endpoint_index = 0xFFFF;
      endpoint->priv_data = priv_data;
 
      /* Add */
@@ -1729,6 +4249,7 @@ endpoint_t *resume(node_t *node, uint8_t flags, uint16_t endpoint_id, void *priv
     } else {
         previous_endpoint->next = endpoint;
     }
+    current_node->endpoint_list_tail = endpoint;
 
     return (endpoint_t *)endpoint;
 }
@@ -1747,6 +4268,17 @@ esp_err_t destroy(node_t *node, endpoint_t *endpoint)
         return ESP_FAIL;
     }
 
+    /* Take lock if not already taken. The endpoint list, the attribute index and the update policy timers are
+    protected by it. Before start, the lock cannot be taken yet and the Matter thread is not running. */
+    lock::status_t lock_status = lock::ALREADY_TAKEN;
+    if (esp_matter_started) {
+        lock_status = lock::chip_stack_lock(portMAX_DELAY, lock::SITE_ENDPOINT_DISABLE);
+        if (lock_status == lock::FAILED) {
+            ESP_LOGE(TAG, "Could not get task context");
+            return ESP_FAIL;
+        }
+    }
+
     /* Find current endpoint and remove from list */
     _endpoint_t *current_endpoint = current_node->endpoint_list;
     _endpoint_t *previous_endpoint = NULL;
@@ -1759,6 +4291,9 @@ esp_err_t destroy(node_t *node, endpoint_t *endpoint)
     }
     if (current_endpoint == NULL) {
         ESP_LOGE(TAG, "Could not find the endpoint to delete");
+        if (lock_status == lock::SUCCESS) {
+            lock::chip_stack_unlock();
+        }
         return ESP_FAIL;
     }
     if (previous_endpoint == NULL) {
@@ -1766,9 +4301,20 @@ esp_err_t destroy(node_t *node, endpoint_t *endpoint)
     } else {
         previous_endpoint->next = current_endpoint->next;
     }
+    if (current_node->endpoint_list_tail == current_endpoint) {
+        current_node->endpoint_list_tail = previous_endpoint;
+    }
+
+    /* Store the pending nonvolatile attributes before the endpoint is freed */
+    attribute::flush_endpoint_nvs(current_endpoint);
+#if CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE
+    attribute::free_snapshot(current_endpoint);
+#endif
 
     /* Disable */
-    disable(endpoint);
+    if (current_endpoint->endpoint_index != 0xFFFF) {
+        disable(endpoint);
+    }
 
     /* Parse and delete all clusters */
     _cluster_t *cluster = current_endpoint->cluster_list;
@@ -1777,9 +4323,12 @@ esp_err_t destroy(node_t *node, endpoint_t *endpoint)
         cluster::destroy((cluster_t *)cluster);
         cluster = next_cluster;
     }
+    if (lock_status == lock::SUCCESS) {
+        lock::chip_stack_unlock();
+    }
 
     /* Free */
-    free(current_endpoint);
+    pool::free_object(pool::TYPE_ENDPOINT, current_endpoint);
     return ESP_OK;
 }
 
@@ -1903,6 +4452,7 @@ node_t *create_raw()
         ESP_LOGE(TAG, "Node already exists");
         return (node_t *)node;
     }
+    pool::record_heap_info(&pool::heap_info_before);
     node = (_node_t *)calloc(1, sizeof(_node_t));
     if (!node) {
         ESP_LOGE(TAG, "Couldn't allocate _node_t");
@@ -19,6 +19,9 @@
 #include <app/util/af-types.h>
 #include <esp_err.h>
 #include <esp_matter_attribute_utils.h>
+#include <string.h>
+
+#include <type_traits>
 
 using chip::app::ConcreteCommandPath;
 using chip::DeviceLayer::ChipDeviceEvent;
@@ -79,6 +82,49 @@ typedef enum status {
     SUCCESS,
 } status_t;
 
+/** Lock call sites, used for the lock statistics */
+typedef enum site {
+    /** Application and other callers */
+    SITE_OTHER,
+    /** attribute::update() */
+    SITE_ATTRIBUTE_UPDATE,
+    /** attribute::get_val_raw() */
+    SITE_ATTRIBUTE_GET_VAL_RAW,
+    /** attribute::get<T>() */
+    SITE_ATTRIBUTE_GET,
+    /** attribute::set_callback() for a path */
+    SITE_ATTRIBUTE_CALLBACK,
+    /** endpoint::enable() */
+    SITE_ENDPOINT_ENABLE,
+    /** endpoint::disable() and endpoint::destroy() */
+    SITE_ENDPOINT_DISABLE,
+    /** Storing the NONVOLATILE attributes */
+    SITE_NVS,
+    /** Data model memory usage diagnostics */
+    SITE_DIAGNOSTICS,
+    /** Number of sites */
+    SITE_MAX,
+} site_t;
+
+/** Number of buckets of the lock time histograms: < 100 us, < 1 ms, < 10 ms, < 100 ms, < 1 s, >= 1 s */
+#define ESP_MATTER_LOCK_HISTOGRAM_SIZE 6
+
+/** Lock statistics for one call site */
+typedef struct stats {
+    /** Number of times the lock was taken */
+    uint32_t count;
+    /** Number of times the lock could not be taken in time */
+    uint32_t timeout_count;
+    /** Histogram of the time waited for the lock */
+    uint32_t wait_histogram[ESP_MATTER_LOCK_HISTOGRAM_SIZE];
+    /** Histogram of the time the lock was held */
+    uint32_t hold_histogram[ESP_MATTER_LOCK_HISTOGRAM_SIZE];
+    /** Maximum time waited for the lock, in microseconds */
+    uint32_t max_wait_us;
+    /** Maximum time the lock was held, in microseconds */
+    uint32_t max_hold_us;
+} stats_t;
+
 /** Stack lock
  *
  * This API should be called before calling any upstream APIs.
@@ -91,6 +137,20 @@ typedef enum status {
  */
 status_t chip_stack_lock(uint32_t ticks_to_wait);
 
+/** Stack lock with call site
+ *
+ * Same as `chip_stack_lock()`, with the wait and hold times accounted to the given call site when
+ * `CONFIG_ESP_MATTER_LOCK_STATS_ENABLE` is set.
+ *
+ * @param[in] ticks_to_wait number of ticks to wait for trying to take the lock. Accepted values: 0 to portMAX_DELAY.
+ * @param[in] site Call site.
+ *
+ * @return FAILED if the lock was not taken within the specified ticks.
+ * @return ALREADY_TAKEN if the lock was already taken by the same task context.
+ * @return SUCCESS if the lock was taken successfully.
+ */
+status_t chip_stack_lock(uint32_t ticks_to_wait, site_t site);
+
 /** Stack unlock
  *
  * This API should be called after the upstream APIs have been done calling.
@@ -102,8 +162,227 @@ status_t chip_stack_lock(uint32_t ticks_to_wait);
  */
 esp_err_t chip_stack_unlock();
 
+/** Get lock statistics
+ *
+ * Get the lock statistics of the given call site. This needs `CONFIG_ESP_MATTER_LOCK_STATS_ENABLE`.
+ *
+ * @param[in] site Call site.
+ * @param[out] stats Pointer to the statistics.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_stats(site_t site, stats_t *stats);
+
+/** Print lock statistics
+ *
+ * Print the lock statistics of all the call sites.
+ */
+void print_stats();
+
 } /* lock */
 
+namespace pool {
+
+/** Data model allocation types */
+typedef enum type {
+    /** Endpoint */
+    TYPE_ENDPOINT,
+    /** Cluster */
+    TYPE_CLUSTER,
+    /** Attribute */
+    TYPE_ATTRIBUTE,
+    /** Command */
+    TYPE_COMMAND,
+    /** Attribute bounds */
+    TYPE_BOUNDS,
+    /** Attribute min max default value */
+    TYPE_MIN_MAX,
+    /** Attribute default value of up to 8 bytes */
+    TYPE_VALUE,
+    /** Number of types */
+    TYPE_MAX,
+} type_t;
+
+/** Allocation statistics for one type */
+typedef struct stats {
+    /** Size of one object */
+    uint16_t object_size;
+    /** Objects currently in use */
+    uint32_t in_use;
+    /** Maximum objects in use at any time */
+    uint32_t peak;
+    /** Total number of allocations */
+    uint32_t alloc_count;
+    /** Total number of frees */
+    uint32_t free_count;
+    /** Number of allocations taken from the heap. With the pool enabled, this is the number of chunks. */
+    uint32_t heap_alloc_count;
+    /** Number of objects which the allocated chunks can hold. This is 0 if the pool is disabled. */
+    uint32_t capacity;
+} stats_t;
+
+/** Heap snapshot */
+typedef struct heap_info {
+    /** Free internal heap */
+    size_t free_size;
+    /** Largest free internal block */
+    size_t largest_free_block;
+    /** Minimum free internal heap ever */
+    size_t minimum_free_size;
+} heap_info_t;
+
+/** Get allocation statistics
+ *
+ * Get the allocation statistics of the data model objects of the given type. The statistics are maintained whether
+ * or not the pool allocator (`CONFIG_ESP_MATTER_MEM_POOL_ENABLE`) is used.
+ *
+ * @param[in] type Allocation type.
+ * @param[out] stats Pointer to the statistics.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_stats(type_t type, stats_t *stats);
+
+/** Get heap snapshots
+ *
+ * Get the internal heap state recorded before the data model was created (`node::create_raw()`) and when
+ * `esp_matter::start()` was called, after the data model was created.
+ *
+ * @param[out] before Heap state before the data model was created. This can be NULL.
+ * @param[out] after Heap state after the data model was created. This can be NULL.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_heap_info(heap_info_t *before, heap_info_t *after);
+
+/** Print allocation statistics
+ *
+ * Print the allocation statistics for all the types along with the heap snapshots.
+ */
+void print_stats();
+
+/** Memory used by a part of the data model */
+typedef struct usage {
+    /** Bytes allocated */
+    size_t size;
+    /** Number of allocations */
+    uint32_t count;
+} usage_t;
+
+/** Memory used by an endpoint or a cluster, by category */
+typedef struct data_model_usage {
+    /** Endpoint, cluster, attribute and command objects */
+    usage_t objects;
+    /** Heap buffers of the string attribute values, and the NVS snapshot of the endpoint */
+    usage_t values;
+    /** Default value buffers, and the min max values with their buffers */
+    usage_t default_values;
+    /** Attribute bounds and update policies */
+    usage_t bounds;
+    /** Ember metadata of the enabled endpoint: the metadata block, the command table and the cluster shapes */
+    usage_t metadata;
+    /** Sum of all the categories */
+    usage_t total;
+} data_model_usage_t;
+
+/** Get endpoint memory usage
+ *
+ * Get the memory used by the endpoint, including all its clusters, attributes and commands. The objects taken from
+ * the pool (`CONFIG_ESP_MATTER_MEM_POOL_ENABLE`) are counted with their object size, and the heap overhead of the
+ * allocations is not included. A cluster shape shared by multiple clusters is divided between them, and is only
+ * counted as an allocation for the cluster using it alone.
+ *
+ * @param[in] endpoint Endpoint handle.
+ * @param[out] usage Pointer to the memory usage.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_endpoint_usage(endpoint_t *endpoint, data_model_usage_t *usage);
+
+/** Get cluster memory usage
+ *
+ * Get the memory used by the cluster, including all its attributes and commands. This is counted in the same way as
+ * `get_endpoint_usage()`.
+ *
+ * @param[in] cluster Cluster handle.
+ * @param[out] usage Pointer to the memory usage.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_cluster_usage(cluster_t *cluster, data_model_usage_t *usage);
+
+/** Print data model memory usage
+ *
+ * Print the memory usage of all the endpoints and their clusters.
+ */
+void print_data_model_usage();
+
+} /* pool */
+
+namespace startup {
+
+/** Startup phases, in the order in which they end during esp_matter::start() */
+typedef enum phase {
+    /** esp_matter::start() called. This is the reference for the other phases. */
+    PHASE_START,
+    /** esp_matter_ota_requestor_init() */
+    PHASE_OTA_REQUESTOR_INIT,
+    /** chip::Platform::MemoryInit() */
+    PHASE_MEMORY_INIT,
+    /** PlatformMgr().InitChipStack() */
+    PHASE_INIT_CHIP_STACK,
+    /** PlatformMgr().StartEventLoopTask() */
+    PHASE_START_EVENT_LOOP,
+    /** Thread stack init and task start. This is not recorded without Thread. */
+    PHASE_THREAD_INIT,
+    /** Waiting for the Matter task to run the init task */
+    PHASE_INIT_TASK_SCHEDULED,
+    /** chip::Server::Init() */
+    PHASE_SERVER_INIT,
+    /** Enabling the endpoints of the data model */
+    PHASE_ENABLE_ALL,
+    /** Startup events and network commissioning init */
+    PHASE_SERVER_STARTED,
+    /** Binding manager init */
+    PHASE_BINDING_INIT,
+    /** Waking up the application task after the init task */
+    PHASE_CHIP_INIT,
+    /** Storing the NVS snapshots and registering the console commands */
+    PHASE_POST_INIT,
+    /** node::read_min_unused_endpoint_id() */
+    PHASE_READ_MIN_UNUSED_ENDPOINT_ID,
+    /** Number of phases */
+    PHASE_MAX,
+} phase_t;
+
+/** Get the startup phase timestamp
+ *
+ * Get the time at which the phase ended, from esp_timer_get_time(). This needs
+ * `CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE`.
+ *
+ * @param[in] phase Startup phase.
+ * @param[out] timestamp_us Time at which the phase ended, in microseconds since boot. This is 0 if the phase has not
+ * been recorded.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t get_timestamp(phase_t phase, int64_t *timestamp_us);
+
+/** Print the startup profile
+ *
+ * Print the duration of each startup phase. The same report is logged as a single line when esp_matter::start()
+ * returns, which can be compared across boots with tools/startup_profile/compare_boots.py.
+ */
+void print_report();
+
+} /* startup */
+
 namespace node {
 
 /** Create raw node
@@ -274,6 +553,46 @@ void *get_priv_data(uint16_t endpoint_id);
  */
 esp_err_t enable(endpoint_t *endpoint, uint16_t parent_endpoint_id);
 
+/** Enable endpoints
+ *
+ * Enable multiple endpoints which have been previously created. This is the same as calling endpoint::enable() for
+ * each of them, but the metadata of all the endpoints is built first, and they are then added with the chip stack
+ * lock taken only once. This should be preferred when many endpoints are enabled together, for example the bridged
+ * endpoints resumed after a reboot.
+ *
+ * @note: The endpoints which could be enabled stay enabled if some of the others fail.
+ *
+ * @param[in] endpoints Array of endpoint handles.
+ * @param[in] parent_endpoint_ids Array of parent endpoint IDs, in the same order as the endpoints. NULL if the
+ * endpoints do not have a parent endpoint.
+ * @param[in] count Number of endpoints.
+ *
+ * @return ESP_OK on success.
+ * @return error of the first endpoint which could not be enabled, in case of failure.
+ */
+esp_err_t enable(endpoint_t **endpoints, const uint16_t *parent_endpoint_ids, size_t count);
+
+/** Set static metadata
+ *
+ * Use a constant endpoint type (for example declared with the DECLARE_DYNAMIC_* macros of
+ * app/util/attribute-storage.h, so that it is placed in flash) for the endpoint instead of generating the metadata
+ * in endpoint::enable(). Only the device types and the data versions are then allocated when the endpoint is enabled.
+ *
+ * @note: The clusters and attributes still need to be created, since their values are stored in the data model. The
+ * endpoint type must describe them in the same order, with the same types, sizes and masks (which include
+ * ATTRIBUTE_FLAG_EXTERNAL_STORAGE) and the same accepted and generated commands, which is checked in
+ * endpoint::enable(). The size of a string attribute can be larger than its current value. This API should be called
+ * before enabling the endpoint.
+ *
+ * @param[in] endpoint Endpoint handle.
+ * @param[in] endpoint_type Endpoint type, which must stay valid while the endpoint is enabled. NULL to use the
+ * generated metadata again.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t set_static_metadata(endpoint_t *endpoint, const EmberAfEndpointType *endpoint_type);
+
 } /* endpoint */
 
 namespace cluster {
@@ -452,6 +771,24 @@ attribute_t *create(cluster_t *cluster, uint32_t attribute_id, uint8_t flags, es
  */
 attribute_t *get(cluster_t *cluster, uint32_t attribute_id);
 
+/** Get attribute by path
+ *
+ * Get the attribute from its endpoint, cluster and attribute IDs. The attributes of the enabled endpoints are looked
+ * up in an index instead of walking the data model, so this is the preferred API on the hot paths.
+ *
+ * @note: The chip stack lock must be held when calling this API, since the index is resized when endpoints are
+ * enabled. The attribute callbacks and the Matter task already hold it, other tasks should use
+ * `lock::chip_stack_lock()` around the call and around the use of the returned handle.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID for the attribute.
+ *
+ * @return Attribute handle on success.
+ * @return NULL in case of failure.
+ */
+attribute_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+
 /** Get first attribute
  *
  * Get the first attribute present on the cluster.
@@ -499,6 +836,20 @@ uint32_t get_id(attribute_t *attribute);
  */
 esp_err_t set_val(attribute_t *attribute, esp_matter_attr_val_t *val);
 
+/** Set attribute val without copy
+ *
+ * Same as `set_val()`, but for CHAR_STRING, OCTET_STRING and ARRAY values the buffer `val->val.a.b` is moved into the
+ * attribute instead of being copied. The buffer must have been allocated with malloc() or calloc() and is owned by
+ * the attribute after this call, even in case of failure, so the caller must not use or free it anymore.
+ *
+ * @param[in] attribute Attribute handle.
+ * @param[in] val Pointer to `esp_matter_attr_val_t`. Use appropriate elements as per the value type.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t set_val_no_copy(attribute_t *attribute, esp_matter_attr_val_t *val);
+
 /** Get attribute val
  *
  * Get the value of the attribute from the database.
@@ -527,6 +878,169 @@ esp_err_t get_val(attribute_t *attribute, esp_matter_attr_val_t *val);
 esp_err_t get_val_raw(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, uint8_t *value,
                       uint16_t attribute_size);
 
+/** Attribute cache
+ *
+ * Attribute resolved for one path, used by the typed `get<T>()` and `update<T>()` APIs. The cache is checked
+ * against the data model generation, which changes whenever an attribute is destroyed or an endpoint is enabled or
+ * disabled, so it never returns a stale attribute handle.
+ */
+typedef struct cache {
+    /** Resolved attribute handle */
+    attribute_t *attribute;
+    /** Endpoint ID the attribute was resolved for */
+    uint16_t endpoint_id;
+    /** Cluster ID the attribute was resolved for */
+    uint32_t cluster_id;
+    /** Attribute ID the attribute was resolved for */
+    uint32_t attribute_id;
+    /** Data model generation the attribute was resolved in */
+    uint32_t generation;
+    /** Whether the endpoint was enabled, so that the attribute is in the Ember metadata */
+    bool enabled;
+} cache_t;
+
+/** Get attribute through cache
+ *
+ * Same as `get(endpoint_id, cluster_id, attribute_id)`, but the attribute is only resolved again if the path is
+ * different from the cached one or if the data model has changed.
+ *
+ * @note: The chip stack lock must be held when calling this API and while using the returned handle, as for
+ * `get(endpoint_id, cluster_id, attribute_id)`.
+ *
+ * @param[in] cache Cache for the attribute. This should be zero initialised before the first call.
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID for the attribute.
+ *
+ * @return Attribute handle on success.
+ * @return NULL in case of failure.
+ */
+attribute_t *get(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+
+/** Get the cache for the attribute type info
+ *
+ * `T` is the generated `TypeInfo` of the attribute, e.g. `OnOff::Attributes::OnOff::TypeInfo`. There is one cache per
+ * attribute type info.
+ */
+template <typename T>
+cache_t *get_cache()
+{
+    static cache_t cache;
+    return &cache;
+}
+
+/** Get the cached attribute for the attribute type info
+ *
+ * @note: The chip stack lock must be held when calling this API and while using the returned handle.
+ */
+template <typename T>
+attribute_t *get_cached(uint16_t endpoint_id)
+{
+    return get(get_cache<T>(), endpoint_id, T::GetClusterId(), T::GetAttributeId());
+}
+
+/** Get attribute value through cache
+ *
+ * Copy the value of the attribute, resolved through the cache, with the chip stack lock held. This is used by
+ * `get<T>()`.
+ *
+ * @param[in] cache Cache for the attribute.
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID for the attribute.
+ * @param[out] value Buffer for the value.
+ * @param[in] size Size of the value. This must be the size of the numeric value type of the attribute.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_SIZE if the value type of the attribute has another size.
+ * @return error in case of failure.
+ */
+esp_err_t get_val(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, void *value,
+                  size_t size);
+
+/** Update attribute value through cache
+ *
+ * Same as `update()`, with the attribute resolved through the cache and the value given as its raw numeric value.
+ * The value type of the attribute is kept. This is used by `update<T>()`.
+ *
+ * @param[in] cache Cache for the attribute.
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] cluster_id Cluster ID of the attribute.
+ * @param[in] attribute_id Attribute ID for the attribute.
+ * @param[in] value New value.
+ * @param[in] size Size of the value. This must be the size of the numeric value type of the attribute.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_SIZE if the value type of the attribute has another size.
+ * @return error in case of failure.
+ */
+esp_err_t update(cache_t *cache, uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, const void *value,
+                 size_t size);
+
+/** Get attribute value by type
+ *
+ * Get the value of the attribute from the database as its generated C++ type. `T` is the generated `TypeInfo` of the
+ * attribute, e.g. `attribute::get<OnOff::Attributes::OnOff::TypeInfo>(endpoint_id, &on_off)`. The storage type is
+ * resolved at compile time and the attribute handle is cached, so this is cheaper than `get_val()` with an attribute
+ * lookup. This takes the chip stack lock, if not already taken.
+ *
+ * @note: Only the non-nullable numeric, enum and bitmap attributes are supported.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[out] value Pointer to the value.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_SIZE if the value type of the attribute does not have the size of the storage type.
+ * @return error in case of failure.
+ */
+template <typename T>
+esp_err_t get(uint16_t endpoint_id, typename T::Type *value)
+{
+    using Traits = chip::app::NumericAttributeTraits<typename T::Type>;
+    using StorageType = typename Traits::StorageType;
+    static_assert(std::is_arithmetic<StorageType>::value || std::is_enum<StorageType>::value,
+                  "Only numeric, enum and bitmap attributes are supported");
+    static_assert(sizeof(StorageType) <= sizeof(esp_matter_val_t), "Attribute type too large");
+
+    StorageType storage;
+    esp_err_t err = get_val(get_cache<T>(), endpoint_id, T::GetClusterId(), T::GetAttributeId(), &storage,
+                            sizeof(storage));
+    if (err != ESP_OK) {
+        return err;
+    }
+    *value = Traits::StorageToWorking(storage);
+    return ESP_OK;
+}
+
+/** Update attribute value by type
+ *
+ * Same as `update()`, but with the value as its generated C++ type. `T` is the generated `TypeInfo` of the
+ * attribute, e.g. `attribute::update<OnOff::Attributes::OnOff::TypeInfo>(endpoint_id, true)`. The value type of the
+ * attribute is kept, and the cached attribute is written without looking it up again.
+ *
+ * @note: Only the non-nullable numeric, enum and bitmap attributes are supported.
+ *
+ * @param[in] endpoint_id Endpoint ID of the attribute.
+ * @param[in] value New value.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_SIZE if the value type of the attribute does not have the size of the storage type.
+ * @return error in case of failure.
+ */
+template <typename T>
+esp_err_t update(uint16_t endpoint_id, typename T::Type value)
+{
+    using Traits = chip::app::NumericAttributeTraits<typename T::Type>;
+    using StorageType = typename Traits::StorageType;
+    static_assert(std::is_arithmetic<StorageType>::value || std::is_enum<StorageType>::value,
+                  "Only numeric, enum and bitmap attributes are supported");
+    static_assert(sizeof(StorageType) <= sizeof(esp_matter_val_t), "Attribute type too large");
+
+    StorageType storage;
+    Traits::WorkingToStorage(value, storage);
+    return update(get_cache<T>(), endpoint_id, T::GetClusterId(), T::GetAttributeId(), &storage, sizeof(storage));
+}
+
 /** Add attribute bounds
  *
  * Add bounds to the attribute. Bounds cannot be added to string/array type attributes.
@@ -551,6 +1065,52 @@ esp_err_t add_bounds(attribute_t *attribute, esp_matter_attr_val_t min, esp_matt
  */
 esp_matter_attr_bounds_t *get_bounds(attribute_t *attribute);
 
+/** Attribute update policy
+ *
+ * Filter for the updates of a numeric attribute, typically for sensor samples. An update through `update()` which
+ * does not pass the policy is held back before the attribute is written, so it neither marks the attribute dirty nor
+ * generates reports. The updates from Matter are not filtered.
+ *
+ * The latest update which is held back by the min interval is applied when that interval expires, and one which is
+ * held back by the thresholds is applied when the max interval expires, so the last sample is not lost. Without a max
+ * interval, the updates below the thresholds are dropped.
+ */
+typedef struct update_policy {
+    /** Minimum absolute change from the current value. 0 to disable. */
+    float min_delta;
+    /** Minimum change from the current value, in percent of the current value. 0 to disable. */
+    float min_delta_percent;
+    /** Minimum time after the last applied update, in milliseconds. 0 to disable. */
+    uint32_t min_interval_ms;
+    /** Maximum time after the last applied update, in milliseconds. Once it has passed, the pending or next update
+     * is applied even if the change is below the thresholds. 0 to disable. */
+    uint32_t max_interval_ms;
+} update_policy_t;
+
+/** Set attribute update policy
+ *
+ * Set the policy for filtering the updates of the attribute. This should be done when creating the attribute. The
+ * policy cannot be set for string/array type attributes.
+ *
+ * @param[in] attribute Attribute handle.
+ * @param[in] policy Pointer to the policy. The policy is copied. NULL to remove the policy.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t set_update_policy(attribute_t *attribute, const update_policy_t *policy);
+
+/** Get attribute update policy
+ *
+ * Get the policy which has been set for the attribute.
+ *
+ * @param[in] attribute Attribute handle.
+ *
+ * @return Pointer to the update policy.
+ * @return NULL in case of failure or if the policy was not set.
+ */
+const update_policy_t *get_update_policy(attribute_t *attribute);
+
 /** Get attribute flags
  *
  * Get the attribute flags for the attribute.
@@ -578,6 +1138,20 @@ uint16_t get_flags(attribute_t *attribute);
  */
 esp_err_t set_override_callback(attribute_t *attribute, callback_t callback);
 
+/** Set attribute write always
+ *
+ * By default, `update()` and `set_val()` skip the write if the new value is the same as the current one, so that it
+ * is neither persisted nor reported. Set this for the attributes where every write must be observed, e.g. to get the
+ * attribute callbacks for repeated values. This sets or clears `ATTRIBUTE_FLAG_WRITE_ALWAYS`.
+ *
+ * @param[in] attribute Attribute handle.
+ * @param[in] write_always true to write the unchanged values too.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t set_write_always(attribute_t *attribute, bool write_always);
+
 /** Get attribute override
  *
  * Get the override callback for the attribute.
@@ -592,6 +1166,9 @@ callback_t get_override_callback(attribute_t *attribute);
  *
  * Store the current attribute val in NVS.
  *
+ * @note: With `CONFIG_ESP_MATTER_NVS_SNAPSHOT_ENABLE`, the attributes of an endpoint which is not enabled yet are
+ * stored when it is enabled, so that its snapshot has all the attributes.
+ *
  * @param[in] attribute Attribute handle.
  *
  * @return ESP_OK on success.
@@ -611,6 +1188,17 @@ esp_err_t store_val_in_nvs(attribute_t *attribute);
  */
 esp_err_t get_val_from_nvs(attribute_t *attribute, esp_matter_attr_val_t *val);
 
+/** Flush NVS
+ *
+ * Store all the pending NONVOLATILE attribute values in NVS. This is only needed with
+ * `CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_ENABLE`, where the values are otherwise stored with a delay of up to
+ * `CONFIG_ESP_MATTER_NVS_WRITE_BEHIND_DELAY_MS`, or at shutdown.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t flush_nvs();
+
 } /* attribute */
 
 namespace command {
@@ -661,6 +1249,21 @@ command_t *create(cluster_t *cluster, uint32_t command_id, uint8_t flags, callba
  */
 command_t *get(cluster_t *cluster, uint32_t command_id, uint16_t flags);
 
+/** Get accepted command by path
+ *
+ * Get the accepted command from its endpoint, cluster and command IDs. The commands of the enabled endpoints are
+ * looked up in a sorted command table instead of walking the data model, so this is used for dispatching the
+ * incoming commands.
+ *
+ * @param[in] endpoint_id Endpoint ID of the command.
+ * @param[in] cluster_id Cluster ID of the command.
+ * @param[in] command_id Command ID for the command.
+ *
+ * @return Command handle on success.
+ * @return NULL in case of failure.
+ */
+command_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t command_id);
+
 /** Get first command
  *
  * Get the first command present on the cluster.
@@ -128,5 +128,17 @@ esp_err_t add_commands(const command_t *command_set, unsigned count);
  */
 esp_err_t diagnostics_register_commands();
 
+/** Add Diagnostics Command Set
+ *
+ * Add a new command set to the 'matter esp diagnostics <sub_command>' command.
+ *
+ * @param[in] command_set Command struct set array pointer
+ * @param[in] count Command struct set array size
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t diagnostics_add_commands(const command_t *command_set, unsigned count);
+
 } // namespace console
 } // namespace esp_matter
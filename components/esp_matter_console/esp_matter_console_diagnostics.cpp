@@ -76,5 +76,10 @@ esp_err_t diagnostics_register_commands()
 
     return add_commands(&command, 1);
 }
+
+esp_err_t diagnostics_add_commands(const command_t *command_set, unsigned count)
+{
+    return diagnostics_console.register_commands(command_set, count);
+}
 } // namespace console
 } // namespace esp_matter
@@ -159,6 +159,9 @@ esp_err_t app_bridge_initialize(node_t *node)
 
     uint16_t matter_endpoint_id_array[MAX_BRIDGED_DEVICE_COUNT];
     esp_matter_bridge::get_bridged_endpoint_ids(matter_endpoint_id_array);
+    endpoint_t *resumed_endpoints[MAX_BRIDGED_DEVICE_COUNT];
+    uint16_t resumed_parent_endpoint_ids[MAX_BRIDGED_DEVICE_COUNT];
+    size_t resumed_count = 0;
     for (size_t idx = 0; idx < MAX_BRIDGED_DEVICE_COUNT; ++idx) {
         if (matter_endpoint_id_array[idx] != chip::kInvalidEndpointId) {
             app_bridged_device_type_t device_type;
@@ -187,10 +190,13 @@ esp_err_t app_bridge_initialize(node_t *node)
             g_bridged_device_list = new_dev;
             g_current_bridged_device_count++;
 
-            //Enable the resumed endpoint
-            esp_matter::endpoint::enable(new_dev->dev->endpoint, new_dev->dev->persistent_info.parent_endpoint_id);
+            resumed_endpoints[resumed_count] = new_dev->dev->endpoint;
+            resumed_parent_endpoint_ids[resumed_count] = new_dev->dev->persistent_info.parent_endpoint_id;
+            resumed_count++;
         }
     }
+    // Enable the resumed endpoints together
+    esp_matter::endpoint::enable(resumed_endpoints, resumed_parent_endpoint_ids, resumed_count);
     return ESP_OK;
 }
 
@@ -12,6 +12,7 @@
 
 #include <device.h>
 #include <esp_matter.h>
+#include <app-common/zap-generated/cluster-objects.h>
 #include <led_driver.h>
 
 #include <app_priv.h>
@@ -55,45 +56,74 @@ static esp_err_t app_driver_light_set_temperature(led_driver_handle_t handle, es
 static void app_driver_button_toggle_cb(void *arg)
 {
     ESP_LOGI(TAG, "Toggle button pressed");
-    uint16_t endpoint_id = light_endpoint_id;
-    uint32_t cluster_id = OnOff::Id;
-    uint32_t attribute_id = OnOff::Attributes::OnOff::Id;
+    bool on_off = false;
+    if (attribute::get<OnOff::Attributes::OnOff::TypeInfo>(light_endpoint_id, &on_off) != ESP_OK) {
+        return;
+    }
+    attribute::update<OnOff::Attributes::OnOff::TypeInfo>(light_endpoint_id, !on_off);
+}
 
-    node_t *node = node::get();
-    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
-    cluster_t *cluster = cluster::get(endpoint, cluster_id);
-    attribute_t *attribute = attribute::get(cluster, attribute_id);
+/* Driver updates. These are called for the attribute paths set in app_driver_light_set_callbacks(), with the driver
+ * handle as the private data. */
+static esp_err_t app_driver_power_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
+                                     uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
+{
+    if (type != attribute::PRE_UPDATE) {
+        return ESP_OK;
+    }
+    return app_driver_light_set_power((led_driver_handle_t)priv_data, val);
+}
 
-    esp_matter_attr_val_t val = esp_matter_invalid(NULL);
-    attribute::get_val(attribute, &val);
-    val.val.b = !val.val.b;
-    attribute::update(endpoint_id, cluster_id, attribute_id, &val);
+static esp_err_t app_driver_brightness_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
+                                          uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
+{
+    if (type != attribute::PRE_UPDATE) {
+        return ESP_OK;
+    }
+    return app_driver_light_set_brightness((led_driver_handle_t)priv_data, val);
 }
 
-esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_t endpoint_id, uint32_t cluster_id,
-                                      uint32_t attribute_id, esp_matter_attr_val_t *val)
+static esp_err_t app_driver_hue_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
+                                   uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
 {
-    esp_err_t err = ESP_OK;
-    if (endpoint_id == light_endpoint_id) {
-        led_driver_handle_t handle = (led_driver_handle_t)driver_handle;
-        if (cluster_id == OnOff::Id) {
-            if (attribute_id == OnOff::Attributes::OnOff::Id) {
-                err = app_driver_light_set_power(handle, val);
-            }
-        } else if (cluster_id == LevelControl::Id) {
-            if (attribute_id == LevelControl::Attributes::CurrentLevel::Id) {
-                err = app_driver_light_set_brightness(handle, val);
-            }
-        } else if (cluster_id == ColorControl::Id) {
-            if (attribute_id == ColorControl::Attributes::CurrentHue::Id) {
-                err = app_driver_light_set_hue(handle, val);
-            } else if (attribute_id == ColorControl::Attributes::CurrentSaturation::Id) {
-                err = app_driver_light_set_saturation(handle, val);
-            } else if (attribute_id == ColorControl::Attributes::ColorTemperatureMireds::Id) {
-                err = app_driver_light_set_temperature(handle, val);
-            }
-        }
+    if (type != attribute::PRE_UPDATE) {
+        return ESP_OK;
     }
+    return app_driver_light_set_hue((led_driver_handle_t)priv_data, val);
+}
+
+static esp_err_t app_driver_saturation_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
+                                          uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
+{
+    if (type != attribute::PRE_UPDATE) {
+        return ESP_OK;
+    }
+    return app_driver_light_set_saturation((led_driver_handle_t)priv_data, val);
+}
+
+static esp_err_t app_driver_temperature_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
+                                           uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
+{
+    if (type != attribute::PRE_UPDATE) {
+        return ESP_OK;
+    }
+    return app_driver_light_set_temperature((led_driver_handle_t)priv_data, val);
+}
+
+esp_err_t app_driver_light_set_callbacks(uint16_t endpoint_id, app_driver_handle_t driver_handle)
+{
+    esp_err_t err = ESP_OK;
+    err |= attribute::set_callback(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id, app_driver_power_cb,
+                                   driver_handle);
+    err |= attribute::set_callback(endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                                   app_driver_brightness_cb, driver_handle);
+    err |= attribute::set_callback(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentHue::Id,
+                                   app_driver_hue_cb, driver_handle);
+    err |= attribute::set_callback(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id,
+                                   app_driver_saturation_cb, driver_handle);
+    err |= attribute::set_callback(endpoint_id, ColorControl::Id,
+                                   ColorControl::Attributes::ColorTemperatureMireds::Id, app_driver_temperature_cb,
+                                   driver_handle);
     return err;
 }
 
@@ -71,15 +71,8 @@ static esp_err_t app_identification_cb(identification::callback_type_t type, uin
 static esp_err_t app_attribute_update_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
                                          uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
 {
-    esp_err_t err = ESP_OK;
-
-    if (type == PRE_UPDATE) {
-        /* Driver update */
-        app_driver_handle_t driver_handle = (app_driver_handle_t)priv_data;
-        err = app_driver_attribute_update(driver_handle, endpoint_id, cluster_id, attribute_id, val);
-    }
-
-    return err;
+    /* The driver is updated from the path callbacks set in app_driver_light_set_callbacks() */
+    return ESP_OK;
 }
 
 extern "C" void app_main()
@@ -114,6 +107,7 @@ extern "C" void app_main()
 
     light_endpoint_id = endpoint::get_id(endpoint);
     ESP_LOGI(TAG, "Light created with endpoint_id %d", light_endpoint_id);
+    app_driver_light_set_callbacks(light_endpoint_id, light_handle);
 
     /* Add additional features to the node */
     cluster_t *cluster = cluster::get(endpoint, ColorControl::Id);
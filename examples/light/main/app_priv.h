@@ -49,21 +49,18 @@ app_driver_handle_t app_driver_light_init();
  */
 app_driver_handle_t app_driver_button_init();
 
-/** Driver Update
+/** Set driver callbacks for light
  *
- * This API should be called to update the driver for the attribute being updated.
- * This is usually called from the common `app_attribute_update_cb()`.
+ * Set the attribute path callbacks which update the driver for the attributes of the light. The other attribute
+ * updates do not reach the driver.
  *
- * @param[in] endpoint_id Endpoint ID of the attribute.
- * @param[in] cluster_id Cluster ID of the attribute.
- * @param[in] attribute_id Attribute ID of the attribute.
- * @param[in] val Pointer to `esp_matter_attr_val_t`. Use appropriate elements as per the value type.
+ * @param[in] endpoint_id Endpoint ID of the light.
+ * @param[in] driver_handle Handle of the light driver.
  *
  * @return ESP_OK on success.
  * @return error in case of failure.
  */
-esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_t endpoint_id, uint32_t cluster_id,
-                                      uint32_t attribute_id, esp_matter_attr_val_t *val);
+esp_err_t app_driver_light_set_callbacks(uint16_t endpoint_id, app_driver_handle_t driver_handle);
 
 /** Set defaults for light driver
  *
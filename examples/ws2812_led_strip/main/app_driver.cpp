@@ -12,6 +12,7 @@
 
 #include <device.h>
 #include <esp_matter.h>
+#include <app-common/zap-generated/cluster-objects.h>
 #include <led_driver.h>
 
 #include <app_priv.h>
@@ -55,19 +56,11 @@ static esp_err_t app_driver_light_set_temperature(led_driver_handle_t handle, es
 static void app_driver_button_toggle_cb(void *arg)
 {
     ESP_LOGI(TAG, "Toggle button pressed");
-    uint16_t endpoint_id = light_endpoint_id;
-    uint32_t cluster_id = OnOff::Id;
-    uint32_t attribute_id = OnOff::Attributes::OnOff::Id;
-
-    node_t *node = node::get();
-    endpoint_t *endpoint = endpoint::get(node, endpoint_id);
-    cluster_t *cluster = cluster::get(endpoint, cluster_id);
-    attribute_t *attribute = attribute::get(cluster, attribute_id);
-
-    esp_matter_attr_val_t val = esp_matter_invalid(NULL);
-    attribute::get_val(attribute, &val);
-    val.val.b = !val.val.b;
-    attribute::update(endpoint_id, cluster_id, attribute_id, &val);
+    bool on_off = false;
+    if (attribute::get<OnOff::Attributes::OnOff::TypeInfo>(light_endpoint_id, &on_off) != ESP_OK) {
+        return;
+    }
+    attribute::update<OnOff::Attributes::OnOff::TypeInfo>(light_endpoint_id, !on_off);
 }
 
 esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_t endpoint_id, uint32_t cluster_id,
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+
+# Copyright 2022 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Script to compare the esp_matter::start() phase durations across boots.
+
+Each input is a serial log (for example captured with `idf.py monitor | tee boot.log`) of one firmware build, which
+can contain several boots. The 'startup_profile:' lines logged by esp_matter (CONFIG_ESP_MATTER_STARTUP_PROFILE_ENABLE)
+are parsed, the median of each phase is taken over the boots of a log, and the logs are compared against the first
+one.
+
+    python compare_boots.py baseline.log new_build.log
+"""
+
+import re
+import sys
+import argparse
+import statistics
+
+PROFILE_MARKER = 'startup_profile:'
+ANSI_ESCAPE = re.compile(r'\x1b\[[0-9;]*m')
+FIELD = re.compile(r'(\w+)_us=(-?\d+)')
+
+
+def parse_log(path):
+    """Return the list of profiles in the log, each a dict of phase name to microseconds, in the logged order"""
+    profiles = []
+    with open(path, 'r', errors='replace') as log:
+        for line in log:
+            line = ANSI_ESCAPE.sub('', line)
+            index = line.find(PROFILE_MARKER)
+            if index < 0:
+                continue
+            profile = {}
+            for name, value in FIELD.findall(line[index + len(PROFILE_MARKER):]):
+                profile[name] = int(value)
+            if profile:
+                profiles.append(profile)
+    return profiles
+
+
+def summarize(profiles):
+    """Return the median of each phase over the profiles, keeping the order in which the phases appear"""
+    phases = []
+    for profile in profiles:
+        for name in profile:
+            if name not in phases:
+                phases.append(name)
+    summary = {}
+    for name in phases:
+        values = [profile[name] for profile in profiles if name in profile]
+        summary[name] = statistics.median(values)
+    return summary
+
+
+def format_delta(value, baseline):
+    if value is None or baseline is None:
+        return '-'
+    delta = value - baseline
+    if baseline == 0:
+        return '{:+.0f}'.format(delta)
+    return '{:+.0f} ({:+.1f}%)'.format(delta, 100.0 * delta / baseline)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare the esp_matter startup profile across boots')
+    parser.add_argument('logs', nargs='+', help='Serial logs, the first one is the baseline')
+    parser.add_argument('--all', action='store_true', help='Print every boot instead of the median of each log')
+    args = parser.parse_args()
+
+    columns = []
+    for path in args.logs:
+        profiles = parse_log(path)
+        if not profiles:
+            print('No startup profile found in {}'.format(path), file=sys.stderr)
+            continue
+        if args.all:
+            for boot, profile in enumerate(profiles):
+                columns.append(('{}#{}'.format(path, boot + 1), profile))
+        else:
+            columns.append(('{} (x{})'.format(path, len(profiles)), summarize(profiles)))
+    if not columns:
+        sys.exit(1)
+
+    phases = []
+    for _, summary in columns:
+        for name in summary:
+            if name not in phases:
+                phases.append(name)
+
+    baseline_name, baseline = columns[0]
+    print('Baseline: {}'.format(baseline_name))
+    header = ['phase (us)', 'baseline'] + [name for name, _ in columns[1:]]
+    rows = [header]
+    for phase in phases:
+        row = [phase, '{:.0f}'.format(baseline[phase]) if phase in baseline else '-']
+        for _, summary in columns[1:]:
+            value = summary.get(phase)
+            if value is None:
+                row.append('-')
+            else:
+                row.append('{:.0f} {}'.format(value, format_delta(value, baseline.get(phase))))
+        rows.append(row)
+
+    widths = [max(len(row[i]) for row in rows) for i in range(len(header))]
+    for row in rows:
+        print('  '.join(cell.ljust(widths[i]) for i, cell in enumerate(row)).rstrip())
+
+
+if __name__ == '__main__':
+    main()